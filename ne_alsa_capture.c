@@ -27,6 +27,15 @@
  *
  *  NOTE:: Only tested with FFTW2; untested with FFTW3 (although API included)
  *
+ * Tracing:
+ *
+ *	With <sys/sdt.h> (systemtap-sdt-dev) at build time, every pipeline
+ *	stage boundary is a USDT probe of provider "ne_capture", see
+ *	NE_PROBE() below, e.g.
+ *
+ *	"bpftrace -e 'usdt:./ne-alsa-capture:ne_capture:publish
+ *	    { @lat_us = hist(arg3 / 1000); }'"
+ *
  * Siro Mugabi, nairobi-embedded.org
  *
  * This program is free software; you can redistribute it and/or modify
@@ -39,9 +48,11 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
  * GNU General Public License for more details.
  */
+#define _GNU_SOURCE		/* CPU affinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <error.h>
 #include <unistd.h>
 #include <limits.h>
@@ -49,38 +60,180 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <alsa/asoundlib.h>
 #include <math.h>
 #include <time.h>
 #include <sched.h>
 #include <signal.h>
+#include <pthread.h>
+#include <byteswap.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "ne_common.h"
+#include "ne_fanout.h"
+#include "ne_kernels.h"
+#include "ne_replay.h"
+
+/*
+ * USDT probes, provider "ne_capture". Arguments are the device index, the
+ * period ("frame") number as published in the fan-out ring, and where
+ * noted the ns spent in the stage that just ended:
+ *
+ *	read_start(dev, frame)
+ *	read_end(dev, frame, frames, ns)	blocked in snd_pcm_readi()
+ *	xrun(dev, frame)
+ *	deinterleave(dev, frame, ns)
+ *	resample(dev, frame, ns)		"--analysis-rate"
+ *	analyze(dev, frame, channel, ns)	one engine call, any thread
+ *	bands(dev, frame, ns)			band ballistics
+ *	publish(dev, frame, ns, latency_ns)	latency: capture to published
+ *
+ * A probe site is a nop until a tracer attaches. Stage durations need the
+ * clock, which is only read while a tracer holds one of the probes'
+ * semaphores; without <sys/sdt.h> all of it compiles away.
+ */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define NE_HAVE_SDT
+#endif
+#endif
+
+#ifdef NE_HAVE_SDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define NE_PROBE_SEMAPHORE(name) \
+	unsigned short ne_capture_##name##_semaphore \
+	    __attribute__((unused)) __attribute__((section(".probes")))
+NE_PROBE_SEMAPHORE(read_start);
+NE_PROBE_SEMAPHORE(read_end);
+NE_PROBE_SEMAPHORE(xrun);
+NE_PROBE_SEMAPHORE(deinterleave);
+NE_PROBE_SEMAPHORE(resample);
+NE_PROBE_SEMAPHORE(analyze);
+NE_PROBE_SEMAPHORE(bands);
+NE_PROBE_SEMAPHORE(publish);
+#define NE_PROBE(name, ...) STAP_PROBEV(ne_capture, name, __VA_ARGS__)
+#define NE_PROBES_ENABLED() \
+	__builtin_expect(ne_capture_read_start_semaphore | \
+			 ne_capture_read_end_semaphore | \
+			 ne_capture_xrun_semaphore | \
+			 ne_capture_deinterleave_semaphore | \
+			 ne_capture_resample_semaphore | \
+			 ne_capture_analyze_semaphore | \
+			 ne_capture_bands_semaphore | \
+			 ne_capture_publish_semaphore, 0)
+#else
+#define NE_PROBE(name, ...) do { } while (0)
+#define NE_PROBES_ENABLED() 0
+#endif
 
 /* =============== FFT related  data ================ */
 #ifdef FFTW3
 #include <fftw3.h>
 typedef fftwf_plan fft_plan;
+typedef fftwf_plan fft_cplan;
 typedef float fftw_real;
 #else
 #include <rfftw.h>
 typedef rfftw_plan fft_plan;
+typedef fftw_plan fft_cplan;
 #endif /* FFTW3 */
 
-fft_plan plan_rc;
-fftw_real *cplx = NULL; /* frequency domain signal */
-fftw_real *real = NULL; /* time domain signal */
+/* channels 0 .. analyze_channels-1 go through the fft; 0 feeds the display */
+static unsigned int analyze_channels = 1;
+/* full-resolution spectrum in shm, see "-S" */
+static int spectrum_kind = -1;
+/* multi-consumer frame ring, see "-F" */
+static unsigned int fanout_slots = 0;
+/* display freq-band layout: the default table or "-B" log-spaced bands;
+ * each device starts out with it, see struct ne_capture_dev */
+static float *fband_hz = ne_glprog_fband;
+static int nbands = 0;	/* no "-B": the default table */
+/* spectrogram history ring, see "-W" */
+static unsigned int waterfall_rows = 0;
+static int waterfall_bins = 0;
+/*
+ * Analysis engines, see "--engine". Goertzel computes only the bins of
+ * the "-T" tones; "auto" takes it when that is cheaper than a full fft.
+ * The octave engine is only used on request.
+ */
+enum {
+	NE_ENGINE_AUTO = -1,
+	NE_ENGINE_FFT,
+	NE_ENGINE_GOERTZEL,
+	NE_ENGINE_OCTAVE,
+	NE_ENGINE_Q15,
+	NE_ENGINE_ZOOM,
+};
+static int engine = NE_ENGINE_AUTO;
+static const char *const engine_name[] = { "fft", "goertzel", "octave", "q15",
+	"zoom" };
+/* time the engines on synthetic periods instead of capturing, "--bench" */
+static int bench_periods = 0;
 
-static int *bin_band = NULL;
-static float hz_per_bin = 0;
-static double *window = NULL;
-/**** SHM IPC w/ "ne_glprog.c" ****/
-struct ne_glprog_fband_data ddata[NE_GLPROG_FBANDS];
-static void *ne_glprog_fband_data_map;
+/*
+ * Octave engine: the signal is halved in rate octave after octave by
+ * half-band low-pass decimators, and each octave gets its own short fft
+ * over its latest NE_OCTAVE_POINTS samples. Bin width thus halves with
+ * every octave down, for about the cost of two full-rate passes.
+ */
+#define NE_OCTAVE_POINTS 128
+#define NE_OCTAVES_MAX 12
+#define NE_HALFBAND_TAPS 31	/* 4k + 3: odd centre, zero even taps */
+static float halfband[NE_HALFBAND_TAPS];
+/*
+ * Zoom engine, "--zoom CENTER,SPAN[,POINTS]": the stream is mixed down
+ * by CENTER to complex baseband, low-passed and decimated to at least
+ * twice SPAN, and a POINTS-point complex fft over the decimated history
+ * resolves the span in bins of rate / decimation / POINTS Hz. Display
+ * bands are spread evenly over the span. The low-pass grows with the
+ * decimation, so that is capped to keep its cost on the capture thread
+ * down; finer bins then take more POINTS.
+ */
+#define NE_ZOOM_POINTS 1024
+#define NE_ZOOM_TAPS 16		/* low-pass taps per unit of decimation */
+#define NE_ZOOM_TAPS_MAX 4096	/* per decimated sample, on the RT thread */
+#define NE_ZOOM_DECIM_MAX (NE_ZOOM_TAPS_MAX / NE_ZOOM_TAPS)
+static float zoom_hz = 0.0f;
+static float zoom_span = 0.0f;
+static int zoom_points = NE_ZOOM_POINTS;
+/* DSP pool workers per device besides the capture thread, "--dsp-threads" */
+static int dsp_threads = 0;
+/* fft channel pairs together in one complex transform, see "--fft-pairs" */
+static int fft_pairs = 0;
+/* explicit tone frequencies, one display band each, see "-T" */
+static int ntones = 0;
+/* display band ballistics in ms, see "--attack", "--release", "--hold" */
+static float attack_ms = 0.0f;
+static float release_ms = 300.0f;
+static float hold_ms = 0.0f;
+/* fft window, see "--window"; scaled to unit coherent gain */
+enum {
+	NE_WINDOW_RECT,
+	NE_WINDOW_HANN,
+	NE_WINDOW_HAMMING,
+	NE_WINDOW_BLACKMAN,
+};
+static int window_kind = NE_WINDOW_RECT;
+static const char *const window_name[] = { "rect", "hann", "hamming",
+	"blackman" };
+/*
+ * "--analysis-rate": capture at the device's own rate and resample the
+ * analyzed channels to this one, so that every host gets the same band
+ * tables, fft sizes and plans; "-p" is then the fft size at this rate.
+ * Polyphase, by up/down = analysis/capture rate in lowest terms, with
+ * NE_RESAMPLE_TAPS windowed-sinc taps per phase and unit of decimation.
+ */
+#define NE_RESAMPLE_TAPS 32
+#define NE_RESAMPLE_TAPS_MAX 256
+#define NE_RESAMPLE_UP_MAX 1024
+#define NE_RESAMPLE_CUTOFF 0.9	/* of the lower of the two nyquists */
+static unsigned int analysis_rate = 0;
 
 /* ============ ALSA Related Globals =============== */
-static char *device = "plughw:0,0";
-static snd_pcm_t *handle;
 static int verbose = 0;		/* snd_pcm_dump() */
 
 /* hwparams and default settings */
@@ -89,24 +242,456 @@ static int verbose = 0;		/* snd_pcm_dump() */
 #define HWPARAMS_RATE 44100
 #define HWPARAMS_PERIOD_FRAMES 1024
 
-static struct {
+struct ne_hwparams {
 	snd_pcm_format_t format;
 	unsigned int channels;
 	unsigned int rate;
 	snd_pcm_uframes_t period_frames;
 	snd_pcm_uframes_t buffer_frames;
-} hwparams = {
+};
+
+/* as requested on the command line; every device starts out with these */
+static struct ne_hwparams hwparams = {
 .format = HWPARAMS_FORMAT,.channels = HWPARAMS_CHANNELS,.rate =
 	    HWPARAMS_RATE,.period_frames = HWPARAMS_PERIOD_FRAMES};
 static snd_pcm_stream_t stream = SND_PCM_STREAM_CAPTURE;
 
-/* holds interleaved channel PCM period signal from H/W buffer */
-static u_char *audiobuf = NULL;
-/* holds deinterleaved channel PCM in separate & contiguous regions */ 
-static float *chnldata = NULL;
 /* raw capture PCM data for plotting program (e.g. "gnuplot(1)") IPC */
 static char *raw_capture_data_file = NULL; /* shm file for raw dump */
-static void *raw_capture_data_map = NULL; /* mmap ptr */
+
+/* back the buffer arena with huge pages, see "-H" */
+static int hugepages = 0;
+
+/* period log, see ne_replay.h: "--record" keeps the newest
+ * "--record-periods" periods, "--replay" feeds one back instead of
+ * capturing (the "replay:" source) */
+#define NE_RECORD_PERIODS_DEFAULT 8192
+#define NE_REPLAY_XRUNS_MAX 1024	/* per record, more is a corrupt log */
+static char *record_file = NULL;
+static unsigned long record_periods = NE_RECORD_PERIODS_DEFAULT;
+static char *replay_file = NULL;
+/* non-ALSA sources: don't pace periods at the stream rate, "--fast" */
+static int source_fast = 0;
+/* "--planar": non-interleaved ALSA access where the device has it */
+static int planar = 0;
+/* "--catch-up": periods read in one go when ALSA has a backlog */
+#define NE_CATCH_UP_DEFAULT 8
+#define NE_CATCH_UP_MAX 64
+static int catch_up = NE_CATCH_UP_DEFAULT;
+/* "--publish-rate": display frames per second, 0 for every period; the
+ * periods in between are aggregated per band as "--publish-mode" says */
+static float publish_rate = 0.0f;
+enum {
+	NE_PUBLISH_MAX,
+	NE_PUBLISH_MEAN,
+};
+static int publish_mode = NE_PUBLISH_MAX;
+/* "--features": per channel level and spectral features in the fan-out
+ * frames, see struct ne_fanout_features */
+static int features = 0;
+#define NE_ONSET_RISE 0.25f	/* flux over its running mean for an onset */
+/* "--gate": channels whose level falls below "gate_db" dBFS are not
+ * analyzed, their bands decay, until it rises "gate_hyst_db" above */
+#define NE_GATE_HYST_DEFAULT 6.0f
+static int gate = 0;
+static float gate_db;
+static float gate_hyst_db = NE_GATE_HYST_DEFAULT;
+/* "--control": fifo of reconfiguration commands, see control_command() */
+static char *control_file = NULL;
+static int control_fd = -1;
+
+static volatile int done = 0;
+
+/*
+ * One anonymous mapping per device holds all of its hot buffers, each
+ * on its own NE_ARENA_ALIGN boundary (a cache line, and enough for any
+ * SIMD load). They are carved in pipeline order so that the buffers a
+ * stage touches sit next to each other.
+ */
+#define NE_ARENA_ALIGN 64
+#define NE_HUGEPAGE_SIZE (2 * 1024 * 1024)
+struct ne_arena {
+	uint8_t *base;		/* NULL while sizing */
+	size_t size;
+	size_t used;
+};
+
+/*
+ * Per-period working buffers of the analysis engines. The capture thread
+ * and each DSP pool worker have their own set, so any of them can run
+ * any channel's analysis.
+ */
+#define NE_DSP_THREADS_MAX 15
+struct ne_scratch {
+	fftw_real *real;	/* time domain signal */
+	fftw_real *cplx;	/* frequency domain signal */
+	/* "--fft-pairs": interleaved complex in/out, second channel's output */
+	fftw_real *zin;
+	fftw_real *zout;
+	fftw_real *cplx2;
+	fftw_real *power;	/* bin powers 0 .. n_points/2 - 1 */
+	/* goertzel state */
+	double *tone_s1;
+	double *tone_s2;
+	/* octave engine: delay line + one period, decimated period
+	 * (ping-pong) and one octave's fft */
+	float *oct_work;
+	float *oct_buf[2];
+	fftw_real *oct_real;
+	fftw_real *oct_cplx;
+	/* zoom engine: delay line + mixed down period, decimated period,
+	 * each re and im, and the fft's interleaved in/out */
+	float *zoom_work[2];
+	float *zoom_dec[2];
+	fftw_real *zoom_z;
+	fftw_real *zoom_zout;
+	/* q15 engine: interleaved re, im fft workspace and bin powers
+	 * 0 .. n_points/2 */
+	int16_t *q15_z;
+	int64_t *q15_power;
+};
+
+/*
+ * "--dsp-threads" fork/join pool. Each phase of a period is a range of
+ * task indices (channels, or ballistics chunks), split evenly across the
+ * participants' queues. A participant drains its own queue first and
+ * then steals from the others; both just fetch_add the queue's "next",
+ * so taking a task is one atomic and nothing is allocated or locked.
+ */
+enum {
+	NE_POOL_ANALYZE,	/* task: one channel, or pair with "--fft-pairs" */
+	NE_POOL_BALLISTICS,	/* task: NE_POOL_CHUNK band values */
+};
+#define NE_POOL_CHUNK 256	/* multiple of a 64 byte line of floats */
+#define NE_POOL_SPIN 4096	/* pause loops before sleeping in futex(2) */
+struct ne_pool_queue {
+	uint32_t next;		/* next task index, owner and thieves */
+	uint32_t end;
+	uint32_t go;		/* phase generation to run, futex word */
+	uint32_t sleeping;	/* waiting on "go", needs a wake */
+} __attribute__((aligned(64)));
+
+struct ne_capture_dev;
+struct ne_pool_worker {
+	struct ne_capture_dev *d;
+	int id;			/* queue and scratch index, 1 .. */
+	pthread_t thread;
+};
+
+struct ne_pool {
+	int workers;		/* started, 0 runs everything inline */
+	int quit;
+	int phase;
+	uint32_t gen;
+	uint32_t pending;	/* workers still in the phase, futex word */
+	uint32_t joining;	/* capture thread waiting on "pending" */
+	struct ne_pool_queue q[NE_DSP_THREADS_MAX + 1];
+	struct ne_pool_worker worker[NE_DSP_THREADS_MAX];
+};
+
+/*
+ * Where a device's periods come from, "-D [SOURCE:]ARG", see ne_sources[].
+ * open() sets up the stream (and may set its hwparams), read() puts one
+ * period into d->an->audiobuf and stamps it, returning its frames, or 0
+ * at the end of the input.
+ */
+struct ne_source {
+	const char *name;
+	int (*open)(struct ne_capture_dev *d);
+	size_t (*read)(struct ne_capture_dev *d);
+	void (*close)(struct ne_capture_dev *d);
+};
+
+/* "synth:" signal generator, see synth_open() */
+enum {
+	NE_SYNTH_TONES,
+	NE_SYNTH_SWEEP,
+	NE_SYNTH_NOISE,
+	NE_SYNTH_IMPULSE,
+};
+#define NE_SYNTH_TONES_MAX 8
+struct ne_synth {
+	int kind;
+	int ntones;
+	double f[NE_SYNTH_TONES_MAX];	/* Hz; sweep: start, end */
+	double phase[NE_SYNTH_TONES_MAX];
+	double amp;		/* "level", fraction of full scale */
+	double noise;		/* "noise" floor, likewise; 0 for none */
+	double secs;		/* sweep length, impulse interval */
+	uint64_t interval;	/* impulse interval in frames */
+	double jitter_ns;	/* late delivery of a period, up to */
+	double xrun_p;		/* chance of an overrun per period */
+	int bytes;		/* per sample */
+	int big_endian;
+	double full_scale;
+	uint64_t frame;		/* frames generated, lost ones included */
+	uint32_t rng;
+};
+
+/*
+ * What "--control" retunes without rebuilding an analysis: ballistics
+ * as per-period coefficients (see ballistics_init()) and the engine's
+ * window at unit coherent gain (see window_init()); the q15 one stays
+ * within Q15, its gain divided out of the levels. The octave engine
+ * keeps its own fixed hann.
+ */
+struct ne_tuning {
+	float attack_coef;
+	float release_coef;
+	float hold_periods;
+	double *window;		/* [n_points] */
+	double *zoom_window;	/* [zoom points] */
+	int16_t *q15_window;	/* [n_points] */
+	float q15_gain;
+};
+
+/*
+ * A device's analysis: the stream as the engines see it, the engines and
+ * their buffers, band state and the shm it publishes to. "--control"
+ * builds a new one off the capture thread and hands it over whole, see
+ * analysis_swap(); what belongs to the stream stays in ne_capture_dev.
+ */
+struct ne_analysis {
+	/* holds interleaved channel PCM period signal from H/W buffer */
+	u_char *audiobuf;	/* planar: one period per channel, in turn */
+	/* "--catch-up": a backlog read in one go, "batch" periods from
+	 * "batchbuf", served one at a time through audiobuf; only the last
+	 * is published, the others skimmed, see publish_fold() */
+	u_char *batchbuf;
+	/* holds deinterleaved channel PCM in separate & contiguous regions;
+	 * with the resampler, each analyzed channel's latest n_points
+	 * samples at the analysis rate */
+	float *chnldata;
+	/* the stream the engines see: "--analysis-rate" and the fft size at
+	 * it, else the capture's own rate and period */
+	unsigned int rate;
+	int n_points;
+	/* "--analysis-rate" resampler, rs_up 0 when the rates match: the
+	 * period deinterleaved to rs_in ([channel][period]) is resampled
+	 * to rs_out and slid into chnldata. Its "fresh" samples, at most
+	 * "fresh_max" and at times a few more than n_points, stay whole in
+	 * rs_out for the engines that take them all in */
+	int rs_up, rs_down, rs_taps;
+	int rs_pos;		/* next output's newest input, in the period */
+	int rs_phase;
+	float *rs_coef;		/* [phase][taps], taps reversed */
+	float *rs_in;
+	float *rs_work;		/* delay line + one period */
+	float *rs_delay;	/* [channel][taps - 1] */
+	float *rs_out;		/* [channel][fresh_max] */
+	int fresh;
+	int fresh_max;
+
+	/* display bands and analyzed channels, the command line's unless
+	 * changed through "--control" */
+	int nbands;
+	float *fband_hz;
+	unsigned int analyze_channels;
+
+	/* analysis engine, do_fft() etc; returns the channels it did */
+	int engine;
+	int (*analyze)(struct ne_capture_dev *d, struct ne_scratch *s,
+		       int channel);
+	/* [0] for the capture thread, [1 ..] for the DSP pool */
+	struct ne_scratch scratch[NE_DSP_THREADS_MAX + 1];
+	/* DSP pool tasks per phase, and channels per analyze task */
+	uint32_t ntasks[2];
+	int step;
+
+	/* fft */
+	fft_plan plan_rc;
+	fft_cplan plan_cc;	/* "--fft-pairs" */
+	int *bin_band;
+	float hz_per_bin;
+	/* octave engine, per analyzed channel and octave: decimator delay
+	 * line, sample history and samples added since its last fft */
+	int octaves;
+	float *oct_delay;	/* [channel][octave][NE_HALFBAND_TAPS - 1] */
+	float *oct_hist;	/* [channel][octave][NE_OCTAVE_POINTS] */
+	int *oct_fresh;		/* [channel][octave] */
+	int *oct_phase;		/* [channel][octave] decimator input parity */
+	double *oct_window;
+	fft_plan plan_oct;
+	/* zoom engine: decimation, its low-pass and kernel; per analyzed
+	 * channel the mixer phase, decimator delay lines and next input,
+	 * and the decimated history */
+	int zoom_decim;
+	int zoom_taps;
+	float *zoom_coef;
+	ne_resample_fn zoom_fir;
+	double *zoom_phase;	/* [channel] */
+	float *zoom_delay;	/* [channel][re, im][taps - 1] */
+	int *zoom_pos;		/* [channel] */
+	float *zoom_hist;	/* [channel][re, im][points] */
+	fft_cplan plan_zoom;
+	/* q15 engine: S16 channel data, twiddles e^(-j2pi k/N) for k < N/2
+	 * and bit-reversal of the N/2-point fft */
+	int16_t *q15_in;	/* [channel][n_points] */
+	int16_t *q15_tw;	/* interleaved cos, -sin */
+	uint16_t *q15_bitrev;
+	/* per band: its octave and bin range in that octave's fft; zoom:
+	 * bin range in the zoom fft, centre bin at points / 2 */
+	int *band_octave;
+	int *band_lo;
+	int *band_hi;
+	/* "-T" tones: nearest fft bin, or goertzel coefficient */
+	int *tone_bin;
+	double *tone_coef;
+	/* per analyzed channel display bands: raw level, ballistics output
+	 * and hold time left in periods, each [channel][band] */
+	float *band_level;
+	float *band_out;
+	float *band_hold;
+	/* whether this period gets published, see publish_fold(), and
+	 * whether it is one a catch-up batch reads ahead of the one that
+	 * will be: then only its band levels are worked out, for the
+	 * ballistics and the fold, no spectrum, waterfall row or features */
+	int due;
+	int skim;
+	/* band_out of the periods since the last publish, folded into
+	 * their max or sum as "--publish-mode" says, [channel][band]; what
+	 * gets published, and of how many */
+	float *band_fold;
+	int folded;
+	int feat_folded;
+	const float *band_pub;
+	uint32_t pub_periods;
+	/* "--features" per analyzed channel: this period's, folded ones as
+	 * for the bands, previous power spectrum, running mean flux */
+	struct ne_fanout_features *feat;
+	struct ne_fanout_features *feat_acc;
+	const struct ne_fanout_features *feat_pub;
+	float *feat_power;	/* [channel][n_points / 2] */
+	float *flux_mean;
+	float full_scale;
+	/* per analyzed channel peak and sum of squares of the period, taken
+	 * with its conversion when "--gate" is on; the gate's state and its
+	 * thresholds as sums of squares */
+	float *ch_peak;
+	double *ch_sumsq;
+	uint8_t *gated;
+	double gate_close;
+	double gate_open;
+	/* ballistics and window: two tunings, the one in use and the one
+	 * "--control" posts for the capture thread to take, see retune() */
+	struct ne_tuning tuning[2];
+	struct ne_tuning *tune;
+	struct ne_tuning *retune;
+
+	/**** SHM IPC w/ "ne_glprog.c" and other readers ****/
+	struct ne_glprog_waterfall *waterfall_map;
+	struct ne_alsa_spectrum *spectrum_map;
+	struct ne_alsa_fanout *fanout_map;
+	void *raw_capture_data_map;
+	size_t raw_capture_data_size;
+
+	struct ne_arena arena;	/* backs the buffers above */
+
+	/* per-stream kernels, see ne_kernels.cc */
+	struct ne_kernels kernels;
+};
+
+/*
+ * Everything one capture device needs, so that several devices can run
+ * side by side, each in its own RT thread. Device "ns" (namespace) is
+ * appended to its posix shm file names.
+ */
+#define NE_MAX_DEVICES 16
+struct ne_capture_dev {
+	int index;
+	char *device;		/* "-D" name */
+	const struct ne_source *src;
+	const char *src_arg;	/* "device" less "SOURCE:" */
+	int fd;			/* "file:", "stdin" */
+	int64_t pace_t0;	/* paced sources: when the first period was fed */
+	uint64_t fed;		/* "file:", "stdin": frames fed so far */
+	struct ne_synth synth;
+	char *ns;		/* shm namespace, "" for the plain names */
+	snd_pcm_t *handle;
+	struct ne_hwparams hwparams;
+	int planar;
+	size_t frame_bytes;
+
+	struct ne_analysis *an;
+
+	/* "--catch-up": periods in the batch last read, the one being
+	 * served, and the newest one's timestamp */
+	int batch;
+	int batch_next;
+	int64_t batch_tstamp_ns;
+	uint64_t batches;
+	uint64_t batch_skipped;
+	/* "--gate" counts */
+	uint64_t gate_closes;
+	uint64_t gate_skipped;
+	int64_t publish_ns;	/* next publish tick, capture time */
+
+	/**** SHM IPC w/ "ne_glprog.c" ****/
+	struct ne_glprog_fband_data ddata[NE_GLPROG_FBANDS_MAX];
+	void *ne_glprog_fband_data_map;
+
+	/* periods captured so far, and when the latest one was read */
+	uint64_t period_count;
+	int64_t capture_tstamp_ns;
+	/* stream start, for aligning devices against each other */
+	int64_t trigger_ns;
+
+	pthread_t thread;
+	int cpu;
+	int state_shown;
+	/* "--record"/"--replay" period log */
+	struct ne_replay_log *log;
+	size_t log_size;
+	uint64_t log_next;	/* replay: next record */
+	int64_t replay_base;	/* replay: first record's timestamp */
+	uint32_t avail;		/* frames left in the buffer after the read */
+	uint32_t xruns;		/* xruns since the last recorded period */
+
+	/* a tracer holds a probe: time the stages, see NE_PROBE() */
+	int tracing;
+	int64_t stage_ns;
+
+	/* "--control": analysis to swap in between two periods, see
+	 * analysis_swap(); "park" holds the capture thread while its ALSA
+	 * device is reopened, see pcm_reopen() */
+	struct ne_swap *next;
+	uint32_t park;
+	uint32_t parked;
+	struct ne_pool pool;
+};
+static struct ne_capture_dev devs[NE_MAX_DEVICES];
+static int ndevs = 0;
+/* snd_pcm_link() all devices to the first one, see "-L" */
+static int link_devices = 0;
+
+/*
+ * Realtime settings per pipeline role, see "-R". Capture threads take
+ * one CPU each out of their role's set; the other roles run on the
+ * whole set.
+ */
+enum {
+	NE_ROLE_CAPTURE,	/* PCM read, per device */
+	NE_ROLE_DSP,		/* fft and band analysis off the capture thread */
+	NE_ROLE_MAIN,		/* reader scans, reporting, "--control" */
+	NE_ROLES
+};
+#define NE_PREFAULT_MAX (1024 * 1024)
+struct ne_rt_role {
+	const char *name;
+	cpu_set_t cpus;
+	int ncpus;		/* 0: no affinity */
+	int policy;
+	int prio;
+	size_t prefault;	/* bytes of stack to touch up front */
+};
+static struct ne_rt_role rt_roles[NE_ROLES] = {
+	[NE_ROLE_CAPTURE] = {"capture", .policy = SCHED_FIFO, .prio = 40,
+			     .prefault = 8 * 1024},
+	[NE_ROLE_DSP] = {"dsp", .policy = SCHED_FIFO, .prio = 35,
+			 .prefault = 8 * 1024},
+	[NE_ROLE_MAIN] = {"main", .policy = SCHED_OTHER, .prio = 0,
+			  .prefault = 8 * 1024},
+};
 
 /* miscalleneous */
 static int quiet_mode = 0;
@@ -127,16 +712,18 @@ do { \
  * ============================================== */
 
 /* I/O error handler */
-static void xrun(void)
+static void xrun(struct ne_capture_dev *d)
 {
 	snd_pcm_status_t *status;
 	int res;
 
 	snd_pcm_status_alloca(&status);
-	if ((res = snd_pcm_status(handle, status)) < 0) {
+	if ((res = snd_pcm_status(d->handle, status)) < 0) {
 		prerr("status error: %s", snd_strerror(res));
 		exit(EXIT_FAILURE);
 	}
+	NE_PROBE(xrun, d->index, d->period_count + 1);
+	d->xruns++;
 	if (snd_pcm_status_get_state(status) == SND_PCM_STATE_XRUN) {
 		struct timeval now, diff, tstamp;
 		gettimeofday(&now, 0);
@@ -146,7 +733,7 @@ static void xrun(void)
 		      stream ==
 		      SND_PCM_STREAM_PLAYBACK ? "underrun" : "overrun",
 		      diff.tv_sec * 1000 + diff.tv_usec / 1000.0);
-		if ((res = snd_pcm_prepare(handle)) < 0) {
+		if ((res = snd_pcm_prepare(d->handle)) < 0) {
 			prerr("xrun: prepare error: %s", snd_strerror(res));
 			exit(EXIT_FAILURE);
 		}
@@ -156,7 +743,7 @@ static void xrun(void)
 		if (stream == SND_PCM_STREAM_CAPTURE) {
 			prwarn
 			    ("capture stream format change? attempting recover...\n");
-			if ((res = snd_pcm_prepare(handle)) < 0) {
+			if ((res = snd_pcm_prepare(d->handle)) < 0) {
 				prerr("xrun(DRAINING): prepare error: %s",
 				      snd_strerror(res));
 				exit(EXIT_FAILURE);
@@ -170,20 +757,20 @@ static void xrun(void)
 }
 
 /* I/O suspend handler */
-static void suspend(void)
+static void suspend(struct ne_capture_dev *d)
 {
 	int res;
 
 	if (!quiet_mode)
 		prwarn("Suspended. Trying resume. ");
 	fflush(stderr);
-	while ((res = snd_pcm_resume(handle)) == -EAGAIN)
+	while ((res = snd_pcm_resume(d->handle)) == -EAGAIN)
 		sleep(1);	/* wait until suspend flag is released */
 	if (res < 0) {
 		if (!quiet_mode)
 			prwarn("Failed. Restarting stream. ");
 		fflush(stderr);
-		if ((res = snd_pcm_prepare(handle)) < 0) {
+		if ((res = snd_pcm_prepare(d->handle)) < 0) {
 			prerr("suspend: prepare error: %s", snd_strerror(res));
 			exit(EXIT_FAILURE);
 		}
@@ -193,28 +780,31 @@ static void suspend(void)
 }
 
 /* *** Acquire ALSA PCM period signal from H/W *** */
-static inline ssize_t pcm_read(u_char * data, size_t rcount)
+static inline ssize_t pcm_read(struct ne_capture_dev *d, u_char * data,
+			       size_t rcount)
 {
 	ssize_t r;
 	size_t result = 0, count = rcount;
-	uint32_t channels = hwparams.channels;
-	snd_pcm_uframes_t period_size = hwparams.period_frames;
-	snd_pcm_format_t format = hwparams.format;
-	uint32_t fmt_phys_width_bits = snd_pcm_format_physical_width(format);
-	uint32_t fmt_phys_width_bytes = fmt_phys_width_bits / 8;
-	uint32_t fmt_phys_width_bytes_per_frame =
-	    fmt_phys_width_bytes * channels;
+	snd_pcm_uframes_t period_size = d->hwparams.period_frames;
+	size_t plane = period_size * (d->frame_bytes / d->hwparams.channels);
+	void *planes[d->hwparams.channels];
+	unsigned int j;
 
-	assert(count == period_size);
+	assert(count % period_size == 0 && (!d->planar || count == period_size));
 
 	while (count > 0) {
-		r = snd_pcm_readi(handle, data, count);
+		if (d->planar) {
+			for (j = 0; j < d->hwparams.channels; j++)
+				planes[j] = data + j * plane;
+			r = snd_pcm_readn(d->handle, planes, count);
+		} else
+			r = snd_pcm_readi(d->handle, data, count);
 		if (r == -EAGAIN || (r >= 0 && (size_t) r < count)) {
-			snd_pcm_wait(handle, 1000);
+			snd_pcm_wait(d->handle, 1000);
 		} else if (r == -EPIPE) {
-			xrun();
+			xrun(d);
 		} else if (r == -ESTRPIPE) {
-			suspend();
+			suspend(d);
 		} else if (r < 0) {
 			prerr("read error: %s", snd_strerror(r));
 			exit(EXIT_FAILURE);
@@ -222,21 +812,23 @@ static inline ssize_t pcm_read(u_char * data, size_t rcount)
 		if (r > 0) {
 			result += r;
 			count -= r;
-			data += r * fmt_phys_width_bytes_per_frame;
+			data += r * (d->planar ? d->frame_bytes /
+				     d->hwparams.channels : d->frame_bytes);
 		}
 	}
 	return result;
 }
 
 /* Deinterleave ALSA frames in PCM period buffer into seperate
-	 per-channel buffer regions */
-static inline void deinterleave(void)
-{
-	int i, j, k, chnls = hwparams.channels;
-	float *dst = chnldata;
-	uint8_t *src = audiobuf, *ptr;
-	int32_t psize = hwparams.period_frames;
-	snd_pcm_format_t format = hwparams.format;
+	 per-channel buffer regions; a planar period only needs converting */
+static inline void deinterleave(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int i, j, k, chnls = d->hwparams.channels;
+	float *dst = an->rs_up ? an->rs_in : an->chnldata;
+	uint8_t *src = an->audiobuf, *ptr;
+	int32_t psize = d->hwparams.period_frames;
+	snd_pcm_format_t format = d->hwparams.format;
 	int fmt_nominal_width_bits = snd_pcm_format_width(format);
 	int fmt_nominal_width_bytes = fmt_nominal_width_bits / 8;
 	int fmt_phys_width_bits = snd_pcm_format_physical_width(format);
@@ -246,16 +838,30 @@ static inline void deinterleave(void)
 		uint32_t u;
 	} resln;
 
+	if (an->kernels.deint && d->planar) {
+		for (j = 0; j < chnls; j++)
+			an->kernels.deint(src +
+					  j * psize * fmt_phys_width_bytes,
+					  dst + j * psize, psize, 1,
+					  j ? NULL : an->raw_capture_data_map);
+		return;
+	}
+	if (an->kernels.deint) {
+		an->kernels.deint(src, dst, psize, chnls,
+				  an->raw_capture_data_map);
+		return;
+	}
+
 	for (i = 0; i < psize; i++) {
-		ptr = src + (i * fmt_phys_width_bytes * chnls);
 		for (j = 0; j < chnls; j++) {
 
 			/* to support variety of sample formats, perform byte-by-byte
 			   extraction for each sample word */
-			ptr += j * fmt_phys_width_bytes;
+			ptr = src + (d->planar ? j * psize + i : i * chnls + j) *
+			    fmt_phys_width_bytes;
 			for (resln.u &= 0x0, k = 0; k < fmt_phys_width_bytes;
 			     k++) {
-				/* handle endianess of current sample format */
+				/* d->handle endianess of current sample format */
 				if (snd_pcm_format_big_endian(format))
 					resln.u |=
 					    ptr[fmt_phys_width_bytes - 1 -
@@ -274,649 +880,4698 @@ static inline void deinterleave(void)
 			dst[i + (psize * j)] = resln.i;
 
 			/* only dumping channel 0 raw pcm in shm for plotting program */
-			if (j == 0 && raw_capture_data_map != NULL)
-				((int32_t *) raw_capture_data_map)[i] = resln.i;
+			if (j == 0 && an->raw_capture_data_map != NULL)
+				((int32_t *) an->raw_capture_data_map)[i] =
+				    resln.i;
 
 		}		/* for(j) */
 	}			/* for(i) */
 }
 
-/* Top-level capture function: acquire a PCM period from H/W */
-static inline void do_capture(void)
+/* S16 only, for the q15 engine: no conversion, analyzed channels only */
+static inline void q15_deinterleave(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int i, j, chnls = d->hwparams.channels;
+	int psize = d->hwparams.period_frames;
+	const int16_t *src = (const int16_t *)an->audiobuf;
+	int16_t *dst = an->q15_in;
+	int swap = !snd_pcm_format_cpu_endian(d->hwparams.format);
+
+	if (d->planar) {
+		for (j = 0; j < (int)an->analyze_channels; j++, dst += psize)
+			if (swap)
+				for (i = 0; i < psize; i++)
+					dst[i] = bswap_16(src[j * psize + i]);
+			else
+				memcpy(dst, src + j * psize,
+				       psize * sizeof(int16_t));
+	} else
+		for (j = 0; j < (int)an->analyze_channels; j++, dst += psize)
+			for (i = 0; i < psize; i++)
+				dst[i] = swap ?
+				    (int16_t)bswap_16(src[i * chnls + j]) :
+				    src[i * chnls + j];
+
+	/* only dumping channel 0 raw pcm in shm for plotting program */
+	if (an->raw_capture_data_map)
+		for (i = 0; i < psize; i++)
+			((int32_t *) an->raw_capture_data_map)[i] =
+			    an->q15_in[i];
+}
+
+/*
+ * Timestamp the newest captured frame on CLOCK_MONOTONIC, from the
+ * driver's hw pointer timestamp less the frames still waiting in the
+ * buffer. Devices share the clock, so their frames can be aligned.
+ */
+static inline void capture_tstamp(struct ne_capture_dev *d)
+{
+	snd_pcm_uframes_t avail;
+	snd_htimestamp_t ts;
+	snd_pcm_status_t *status;
+	int64_t ns;
+
+	if (snd_pcm_htimestamp(d->handle, &avail, &ts) < 0 || !ts.tv_sec) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		avail = 0;
+	}
+	ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	d->capture_tstamp_ns = ns - avail * 1000000000LL / d->hwparams.rate;
+	d->avail = avail;
+
+	if (d->trigger_ns)
+		return;
+	snd_pcm_status_alloca(&status);
+	if (snd_pcm_status(d->handle, status) == 0) {
+		snd_pcm_status_get_trigger_htstamp(status, &ts);
+		ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	}
+	__atomic_store_n(&d->trigger_ns, ns ? ns : d->capture_tstamp_ns,
+			 __ATOMIC_RELEASE);
+}
+
+/* "--record": append the period just read, as read, to the log */
+static inline void record_period(struct ne_capture_dev *d)
+{
+	struct ne_replay_log *log = d->log;
+	struct ne_replay_period *rec = ne_replay_record(log, log->head);
+
+	rec->period = d->period_count + 1;
+	rec->tstamp_ns = d->capture_tstamp_ns;
+	rec->avail = d->avail;
+	rec->xruns = d->xruns;
+	rec->frames = d->hwparams.period_frames;
+	memcpy(rec->pcm, d->an->audiobuf, rec->frames * d->frame_bytes);
+	if (!log->head)
+		log->trigger_ns = d->trigger_ns;
+	__atomic_store_n(&log->head, log->head + 1, __ATOMIC_RELEASE);
+	d->xruns = 0;
+}
+
+/*
+ * Sources other than ALSA feed a period when it would have been captured,
+ * "due" ns after the first one, unless "--fast". Returns the time it is
+ * fed, which stamps the period, so that downstream latencies are those
+ * of this run.
+ */
+static inline int64_t source_pace(struct ne_capture_dev *d, int64_t due)
+{
+	struct timespec ts;
+	int64_t now, t;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	if (!d->pace_t0) {
+		d->pace_t0 = now;
+		__atomic_store_n(&d->trigger_ns, now, __ATOMIC_RELEASE);
+	}
+	t = d->pace_t0 + due;
+	if (source_fast || t <= now)
+		return now;
+	ts.tv_sec = t / 1000000000LL;
+	ts.tv_nsec = t % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+	       == EINTR) ;
+	return t;
+}
+
+/*
+ * "alsa:"; fell behind (more whole periods already waiting), read up to
+ * "--catch-up" of them as well, in one go unless planar
+ */
+static size_t alsa_read(struct ne_capture_dev *d)
 {
+	struct ne_analysis *an = d->an;
 	size_t ret;
-	int channels = hwparams.channels;
-	snd_pcm_uframes_t period_size = hwparams.period_frames;
+	snd_pcm_uframes_t period_size = d->hwparams.period_frames;
+	size_t chunk = period_size * d->frame_bytes;
+	snd_pcm_sframes_t avail;
+	int n = 0, i;
 
 	/* read in an ALSA period from hardware buffer */
-	ret = pcm_read(audiobuf, period_size);
+	ret = pcm_read(d, an->audiobuf, period_size);
 	if (ret != period_size)
 		prwarn("WARNING: copied %zi instead of %zi\n", ret, period_size);
 
+	if (catch_up > 1 && (avail = snd_pcm_avail_update(d->handle)) > 0) {
+		n = avail / period_size;
+		n = n < catch_up - 1 ? n : catch_up - 1;
+	}
+	if (n && !d->planar)
+		ret += pcm_read(d, an->batchbuf + chunk, n * period_size);
+	for (i = 1; i <= n && d->planar; i++)
+		ret += pcm_read(d, an->batchbuf + i * chunk, period_size);
+	d->batch = n + 1;
+	if (n) {
+		d->batches++;
+		d->batch_skipped += n;
+	}
+	capture_tstamp(d);
+	return ret;
+}
+
+/* "file:", "stdin": raw interleaved pcm as given by "-o", "-c", "-r"; a
+ * trailing partial period is dropped */
+static size_t file_read(struct ne_capture_dev *d)
+{
+	size_t got = 0, want = d->hwparams.period_frames * d->frame_bytes;
+	ssize_t r;
+
+	while (got < want) {
+		r = read(d->fd, d->an->audiobuf + got, want - got);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		got += r;
+	}
+	if (got < want)
+		return 0;
+
+	d->fed += d->hwparams.period_frames;
+	d->capture_tstamp_ns = source_pace(d, d->fed * 1e9 / d->hwparams.rate);
+	d->avail = 0;
+	return d->hwparams.period_frames;
+}
+
+/* "replay:": the next logged period, at its recorded pace */
+static size_t replay_read(struct ne_capture_dev *d)
+{
+	struct ne_replay_log *log = d->log;
+	struct ne_replay_period *rec;
+	uint32_t i;
+
+	if (d->log_next >= log->head)
+		return 0;
+	rec = ne_replay_record(log, d->log_next++);
+	if (rec->frames > log->period_frames
+	    || rec->xruns > NE_REPLAY_XRUNS_MAX) {
+		prerr("\"%s\": corrupt record %llu (%u frames, %u xruns)\n",
+		      d->device, (unsigned long long)d->log_next - 1,
+		      rec->frames, rec->xruns);
+		return 0;
+	}
+	if (!d->pace_t0)
+		d->replay_base = rec->tstamp_ns;
+
+	d->capture_tstamp_ns = source_pace(d, rec->tstamp_ns - d->replay_base);
+	memcpy(d->an->audiobuf, rec->pcm, rec->frames * d->frame_bytes);
+	d->avail = rec->avail;
+	for (i = 0; i < rec->xruns; i++)
+		NE_PROBE(xrun, d->index, d->period_count + 1);
+	return rec->frames;
+}
+
+/* uniform in [0, 1), xorshift32 */
+static inline double synth_rand(struct ne_synth *sy)
+{
+	sy->rng ^= sy->rng << 13;
+	sy->rng ^= sy->rng >> 17;
+	sy->rng ^= sy->rng << 5;
+	return sy->rng / 4294967296.0;
+}
+
+static inline double synth_step(double phase, double f, double rate)
+{
+	phase += 2.0 * M_PI * f / rate;
+	return phase < 2.0 * M_PI ? phase : phase - 2.0 * M_PI;
+}
+
+/* one period of the generator's signal, same on every channel but for
+ * the noise floor */
+static void synth_fill(struct ne_capture_dev *d)
+{
+	struct ne_synth *sy = &d->synth;
+	int i, j, k, n = d->hwparams.period_frames;
+	int chnls = d->hwparams.channels;
+	double rate = d->hwparams.rate, x, v, t;
+	uint8_t *p = d->an->audiobuf;
+	uint32_t u;
+
+	for (i = 0; i < n; i++, sy->frame++) {
+		x = 0.0;
+		switch (sy->kind) {
+		case NE_SYNTH_TONES:
+			for (k = 0; k < sy->ntones; k++) {
+				x += sin(sy->phase[k]);
+				sy->phase[k] = synth_step(sy->phase[k], sy->f[k],
+							  rate);
+			}
+			x *= sy->amp;
+			break;
+		case NE_SYNTH_SWEEP:
+			/* exponential, restarting every "secs" */
+			x = sy->amp * sin(sy->phase[0]);
+			t = fmod(sy->frame / rate, sy->secs) / sy->secs;
+			sy->phase[0] = synth_step(sy->phase[0], sy->f[0] *
+						  pow(sy->f[1] / sy->f[0], t),
+						  rate);
+			break;
+		case NE_SYNTH_NOISE:
+			x = sy->amp * (2.0 * synth_rand(sy) - 1.0);
+			break;
+		case NE_SYNTH_IMPULSE:
+			x = sy->frame % sy->interval ? 0.0 : sy->amp;
+			break;
+		}
+		for (j = 0; j < chnls; j++, p += sy->bytes) {
+			v = x;
+			if (sy->noise > 0.0)
+				v += sy->noise * (2.0 * synth_rand(sy) - 1.0);
+			v = v > 1.0 ? 1.0 : v < -1.0 ? -1.0 : v;
+			u = (uint32_t)(int32_t)lrint(v * sy->full_scale);
+			for (k = 0; k < sy->bytes; k++)
+				p[sy->big_endian ? sy->bytes - 1 - k : k] =
+				    u >> 8 * k;
+		}
+	}
+}
+
+/* "synth:" */
+static size_t synth_read(struct ne_capture_dev *d)
+{
+	struct ne_synth *sy = &d->synth;
+	int64_t due;
+
+	/* simulated overrun: a period's worth of signal is lost */
+	if (sy->xrun_p > 0.0 && synth_rand(sy) < sy->xrun_p) {
+		synth_fill(d);
+		prwarn("overrun!!! (simulated, %.3f ms lost)\n",
+		       1e3 * d->hwparams.period_frames / d->hwparams.rate);
+		NE_PROBE(xrun, d->index, d->period_count + 1);
+		d->xruns++;
+	}
+	synth_fill(d);
+
+	due = sy->frame * 1e9 / d->hwparams.rate;
+	if (sy->jitter_ns > 0.0)
+		due += synth_rand(sy) * sy->jitter_ns;
+	d->capture_tstamp_ns = source_pace(d, due);
+	d->avail = 0;
+	return d->hwparams.period_frames;
+}
+
+/* ns since "*t" while tracing, restarting it there; 0 otherwise */
+static inline int64_t stage_lap(const struct ne_capture_dev *d, int64_t *t)
+{
+	struct timespec ts;
+	int64_t now, lap;
+
+	if (!d->tracing)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	lap = now - *t;
+	*t = now;
+	return lap;
+}
+
+/*
+ * "--analysis-rate": each analyzed channel's period through the
+ * polyphase filter, continuing from the previous period's delay line,
+ * phase and input offset, and onto the end of its history in chnldata.
+ * The filter delays the analysis by half its length.
+ */
+static inline void resample(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	unsigned int ch;
+	int m = 0, pos = 0, phase = 0, n = d->hwparams.period_frames;
+	const int len = an->rs_taps - 1, N = an->n_points;
+	float *hist, *out;
+
+	for (ch = 0; ch < an->analyze_channels; ch++) {
+		out = an->rs_out + ch * an->fresh_max;
+		memcpy(an->rs_work, an->rs_delay + ch * len,
+		       len * sizeof(float));
+		memcpy(an->rs_work + len, an->rs_in + ch * n,
+		       n * sizeof(float));
+		pos = an->rs_pos;
+		phase = an->rs_phase;
+		m = an->kernels.resample(an->rs_work, n, an->rs_coef,
+					 an->rs_taps, an->rs_up, an->rs_down,
+					 &pos, &phase, out);
+		memcpy(an->rs_delay + ch * len, an->rs_work + n,
+		       len * sizeof(float));
+
+		/* slide the history along */
+		hist = an->chnldata + ch * N;
+		if (m >= N)
+			memcpy(hist, out + m - N, N * sizeof(float));
+		else {
+			memmove(hist, hist + m, (N - m) * sizeof(float));
+			memcpy(hist + N - m, out, m * sizeof(float));
+		}
+	}
+	an->rs_pos = pos;
+	an->rs_phase = phase;
+	an->fresh = m;
+}
+
+/*
+ * "--gate": each analyzed channel's level, converted samples still in
+ * cache, against the gate's thresholds: below "gate_db" it closes,
+ * "gate_hyst_db" above that it opens again.
+ */
+static inline void gate_update(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	unsigned int ch;
+	int n_points = an->n_points;
+
+	for (ch = 0; ch < an->analyze_channels; ch++) {
+		an->kernels.stats(an->chnldata + ch * n_points, n_points,
+				  &an->ch_peak[ch], &an->ch_sumsq[ch]);
+		if (!an->gated[ch] && an->ch_sumsq[ch] < an->gate_close) {
+			an->gated[ch] = 1;
+			d->gate_closes++;
+		} else if (an->gated[ch] && an->ch_sumsq[ch] > an->gate_open)
+			an->gated[ch] = 0;
+		d->gate_skipped += an->gated[ch];
+	}
+}
+
+/* the next period of a batch read by alsa_read(), stamped as its place in
+ * the batch says */
+static inline size_t batch_next(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	snd_pcm_uframes_t period_size = d->hwparams.period_frames;
+	int left = d->batch - 1 - ++d->batch_next;
+
+	an->audiobuf = an->batchbuf +
+	    d->batch_next * period_size * d->frame_bytes;
+	d->capture_tstamp_ns = d->batch_tstamp_ns -
+	    left * period_size * 1000000000LL / d->hwparams.rate;
+	d->avail -= period_size;
+	return period_size;
+}
+
+/* Top-level capture function: acquire a PCM period from the source; -1
+ * at the end of its input */
+static inline int do_capture(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	size_t ret;
+
+	d->tracing = NE_PROBES_ENABLED();
+	stage_lap(d, &d->stage_ns);
+	NE_PROBE(read_start, d->index, d->period_count + 1);
+
+	if (d->batch_next + 1 < d->batch)
+		ret = batch_next(d);
+	else {
+		an->audiobuf = an->batchbuf;
+		d->batch = 1;
+		d->batch_next = 0;
+		if (!(ret = d->src->read(d)))
+			return -1;
+		/* the batch's periods in turn, oldest first */
+		if (d->batch > 1) {
+			d->batch_tstamp_ns = d->capture_tstamp_ns;
+			d->avail += d->batch * d->hwparams.period_frames;
+			d->batch_next = -1;
+			ret = batch_next(d);
+		}
+	}
+	if (record_file)
+		record_period(d);
+	an->skim = d->batch_next + 1 < d->batch;
+	an->due = !an->skim &&
+	    (!publish_rate || d->capture_tstamp_ns >= d->publish_ns);
+	NE_PROBE(read_end, d->index, d->period_count + 1, ret,
+		 stage_lap(d, &d->stage_ns));
+
 	/* extract interleaved per-channel data */
-	memset(chnldata, 0, (period_size * sizeof(float) * channels));
-	deinterleave();
+	if (an->engine == NE_ENGINE_Q15)
+		q15_deinterleave(d);
+	else
+		deinterleave(d);
+	if (an->rs_up) {
+		NE_PROBE(deinterleave, d->index, d->period_count + 1,
+			 stage_lap(d, &d->stage_ns));
+		resample(d);
+	}
+	if (gate)
+		gate_update(d);
+	d->period_count++;
+	/* the gate's level pass counts with the stage it reads the output of */
+	if (an->rs_up)
+		NE_PROBE(resample, d->index, d->period_count,
+			 stage_lap(d, &d->stage_ns));
+	else
+		NE_PROBE(deinterleave, d->index, d->period_count,
+			 stage_lap(d, &d->stage_ns));
+	return 0;
 }
 
 /* *** obtain frequency band mangitude *** */
-static inline float freq_band_magn(int offset, int count)
+static inline float freq_band_magn(const fftw_real *P, int offset, int count)
 {
 	int i;
-	int length = hwparams.period_frames;
 
 #if 0
 	/* return the averge contribution */
-	float re, im, total = 0.0f;
-	for (i = 0; i < count; i++) {
-		re = cplx[i + offset];
-		im = cplx[length - offset - i];
-		total += sqrt(re * re + im * im);
-	}
+	float total = 0.0f;
+	for (i = 0; i < count; i++)
+		total += sqrt(P[i + offset]);
 	return total / count;
 #else
 	/* return the tallest peak */
-	fftw_real re, im, tmp, val = 0.0f;
-	for (i = 0; i < count; i++) {
-		re = cplx[i + offset];
-		im = cplx[length - offset - i];
-		tmp = sqrt(re * re + im * im);
-		val = tmp > val ? tmp : val;
-	}
-	return (float)val;
+	fftw_real val = 0.0f;
+	for (i = 0; i < count; i++)
+		val = P[i + offset] > val ? P[i + offset] : val;
+	return (float)sqrt(val);
 #endif
 
 }
 
-/* func : do_fft()
- * desc : performs fft processing on a given channel 
- * notes: for simultaneous fft processing on stereo signals, see (for example)
- *        "http://nairobi-embedded.org/ne_fft_notes.html"
+/* map a raw fft magnitude onto the 0..250 display scale of "ne_glprog" */
+static inline float magn_calib(float magn)
+{
+	float tmp;
+
+	/* calibration is maddening */
+	tmp = magn > 0.0f ? logf(magn) * 16.7f : 0.0f;
+	tmp = tmp > 172.0f ? (tmp - 172.0f) * 3.2f : 0.0f;
+	/* clip excessive levels */
+	return tmp < 250.0f ? tmp : 250.0f;
+}
+
+/* next waterfall row to fill, or NULL if the history ring is disabled
+ * or the period is skimmed */
+static inline float *waterfall_row(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	struct ne_glprog_waterfall *wf = an->waterfall_map;
+
+	if (!wf || an->skim)
+		return NULL;
+	return wf->data + (size_t)(wf->row_count % wf->rows) * wf->cols;
+}
+
+/* make the row returned by waterfall_row() visible to readers */
+static inline void waterfall_commit(struct ne_capture_dev *d)
+{
+	struct ne_glprog_waterfall *wf = d->an->waterfall_map;
+
+	__atomic_store_n(&wf->row_count, wf->row_count + 1, __ATOMIC_RELEASE);
+}
+
+/* where the fft of "channel" goes: straight into the shm slot being filled
+ * when publishing the raw halfcomplex spectrum this period, else the
+ * private buffer */
+static inline fftw_real *spectrum_out(struct ne_capture_dev *d, int channel,
+				      fftw_real *local)
+{
+	struct ne_analysis *an = d->an;
+	struct ne_alsa_spectrum *sp = an->spectrum_map;
+	fftw_real *slot;
+
+	if (!sp || sp->kind != NE_SPECTRUM_HALFCOMPLEX || !an->due)
+		return local;
+	slot = (fftw_real *)sp->data + ((sp->seq + 1) & 1) *
+	    (size_t)sp->channels * sp->nvals;
+	return slot + (size_t)channel * sp->nvals;
+}
+
+/* bin magnitudes DC .. Nyquist of halfcomplex "X", written to "out" */
+static inline void spectrum_magn(struct ne_capture_dev *d, const fftw_real *X,
+				 fftw_real *out)
+{
+	int bin, n_points = d->an->n_points;
+
+	out[0] = fabs(X[0]);
+	for (bin = 1; bin < (n_points + 1) / 2; bin++)
+		out[bin] = sqrt(X[bin] * X[bin] +
+				X[n_points - bin] * X[n_points - bin]);
+	if (!(n_points % 2))
+		out[n_points / 2] = fabs(X[n_points / 2]);
+}
+
+/* publish the slot filled by this period's do_fft() calls */
+static inline void spectrum_commit(struct ne_capture_dev *d)
+{
+	struct ne_alsa_spectrum *sp = d->an->spectrum_map;
+
+	if (!sp)
+		return;
+	sp->frame[(sp->seq + 1) & 1] = d->period_count;
+	sp->tstamp_ns[(sp->seq + 1) & 1] = d->capture_tstamp_ns;
+	__atomic_store_n(&sp->seq, sp->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* check on the fan-out readers: report the ones lagging by more than half
+ * the ring, and free the slots of readers that exited without detaching */
+static void fanout_scan(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int i;
+	uint32_t pid;
+	uint64_t lag, head = an->fanout_map->head;
+	struct ne_fanout_reader *rd;
+
+	for (i = 0; i < NE_FANOUT_READERS; i++) {
+		rd = &an->fanout_map->reader[i];
+		pid = __atomic_load_n(&rd->pid, __ATOMIC_ACQUIRE);
+		if (!pid)
+			continue;
+
+		lag = head - __atomic_load_n(&rd->cursor, __ATOMIC_ACQUIRE);
+		if (lag > rd->lag_max)
+			rd->lag_max = lag;
+
+		if (lag <= an->fanout_map->slots / 2) {
+			if (rd->slow)
+				prinfo("\"%s\" fan-out reader %u caught up\n",
+				       d->device, pid);
+			rd->slow = 0;
+			continue;
+		}
+
+		if (kill(pid, 0) < 0 && errno == ESRCH) {
+			prwarn("\"%s\" fan-out reader %u is gone, "
+			       "freeing slot %d\n", d->device, pid, i);
+			__atomic_store_n(&rd->pid, 0, __ATOMIC_RELEASE);
+			continue;
+		}
+		if (!rd->slow)
+			prwarn("\"%s\" fan-out reader %u is slow: %llu frames "
+			       "behind, %llu dropped\n", d->device, pid,
+			       (unsigned long long)lag,
+			       (unsigned long long)rd->drops);
+		rd->slow = 1;
+	}
+}
+
+/* broadcast this period's per-channel bands; never waits for readers */
+static inline void fanout_publish(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	struct ne_alsa_fanout *fo = an->fanout_map;
+	struct ne_fanout_frame *slot;
+	uint64_t head;
+	unsigned int i;
+
+	if (!fo)
+		return;
+
+	head = fo->head;
+	slot = ne_fanout_slot(fo, head);
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->period = d->period_count;
+	slot->tstamp_ns = d->capture_tstamp_ns;
+	slot->flags = d->batch > 1 ? NE_FANOUT_CAUGHT_UP : 0;
+	slot->periods = an->pub_periods;
+	slot->gated = 0;
+	for (i = 0; gate && i < an->analyze_channels && i < 64; i++)
+		slot->gated |= (uint64_t)an->gated[i] << i;
+	if (gate && slot->gated == (an->analyze_channels < 64 ?
+				    (1ULL << an->analyze_channels) - 1 : ~0ULL))
+		slot->flags |= NE_FANOUT_GATED;
+	memcpy(slot->bands, an->band_pub,
+	       an->analyze_channels * an->nbands * sizeof(float));
+	if (fo->features)
+		memcpy(ne_fanout_frame_features(fo, slot), an->feat_pub,
+		       an->analyze_channels * sizeof(*an->feat_pub));
+	__atomic_store_n(&slot->seq, head + 1, __ATOMIC_RELEASE);
+	if (!head)
+		fo->trigger_ns = d->trigger_ns;
+	fo->gate_closes = d->gate_closes;
+	fo->gated = d->gate_skipped;
+	__atomic_store_n(&fo->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * "--features" of a channel's power spectrum "P" (0 < k < n/2), in one
+ * pass but for the rolloff's partial one: power weighted centroid,
+ * 85% rolloff, and the half-wave rectified rise of the bin powers over
+ * the previous period, relative to their sum, as the flux. An onset is
+ * a flux well above its running mean.
  */
-static inline void do_fft(int channel)
+static inline void spectral_features(struct ne_capture_dev *d, int channel,
+				     const fftw_real *P)
 {
-	int i, bin, count, offset, n_points = hwparams.period_frames;
-	float magn, tmp = 0.0f;
-	static float prevtmp[NE_GLPROG_FBANDS];
-	void *map = ne_glprog_fband_data_map;
+	struct ne_analysis *an = d->an;
+	int k, half = an->n_points / 2;
+	struct ne_fanout_features *f = &an->feat[channel];
+	float *__restrict prev = an->feat_power + channel * half;
+	float *mean = &an->flux_mean[channel];
+	double sum = 0.0, sumk = 0.0, rise = 0.0, acc;
 
-	/* initialize fftw input buffer */
-	offset = channel * n_points;
-	for (i = 0; i < n_points; i++)
-		real[i] = (double)chnldata[offset + i] * window[i];
+	for (k = 1; k < half; k++) {
+		sum += P[k];
+		sumk += k * P[k];
+		rise += P[k] > prev[k] ? P[k] - prev[k] : 0.0f;
+		prev[k] = P[k];
+	}
+	f->centroid_hz = sum > 0.0 ? sumk / sum * an->hz_per_bin : 0.0f;
+	for (acc = 0.0, k = 1; k < half - 1 && (acc += P[k]) < 0.85 * sum; k++)
+		;
+	f->rolloff_hz = sum > 0.0 ? k * an->hz_per_bin : 0.0f;
 
-	/* fftw real->complex transform */
-#ifdef FFTW3
-	fftwf_execute(plan_rc);
-#else
-	rfftw_one(plan_rc, real, cplx);
-#endif
+	f->flux = sum > 0.0 ? rise / sum : 0.0f;
+	/* the first flux is against silence, the second seeds the mean */
+	f->onset = d->period_count > 2 && f->flux > *mean + NE_ONSET_RISE;
+	*mean = d->period_count > 2 ? 0.9f * *mean + 0.1f * f->flux : f->flux;
+}
+
+/* func : fft_bands()
+ * desc : everything downstream of a channel's halfcomplex spectrum "X":
+ *        shm spectrum, waterfall row, tone and display band levels
+ */
+static inline void fft_bands(struct ne_capture_dev *d, struct ne_scratch *s,
+			     int channel, const fftw_real *X)
+{
+	struct ne_analysis *an = d->an;
+	int i, bin, count, offset, n_points = an->n_points;
+	float magn, tmp;
+	float *level = an->band_level + channel * an->nbands;
+	float *row = channel == 0 ? waterfall_row(d) : NULL;
+	struct ne_alsa_spectrum *sp = an->due ? an->spectrum_map : NULL;
+
+	if (sp && sp->kind == NE_SPECTRUM_MAGN)
+		spectrum_magn(d, X, (fftw_real *)sp->data +
+			      (((sp->seq + 1) & 1) * (size_t)sp->channels +
+			       channel) * sp->nvals);
+
+	/* full-resolution waterfall row: bins 0 (DC) .. n/2 (Nyquist) */
+	if (row && waterfall_bins) {
+		row[0] = magn_calib(fabs(X[0]));
+		for (bin = 1; bin < (n_points + 1) / 2; bin++)
+			row[bin] = magn_calib(sqrtf(X[bin] * X[bin] +
+			                            X[n_points - bin] *
+			                            X[n_points - bin]));
+		if (!(n_points % 2))
+			row[n_points / 2] = magn_calib(fabs(X[n_points / 2]));
+	} else if (row)
+		memset(row, 0, an->nbands * sizeof(float));
+
+	/* "-T" tones: one bin per band */
+	for (i = 0; i < ntones; i++) {
+		bin = an->tone_bin[i];
+		level[i] = magn_calib(bin == 0 || bin == n_points - bin ?
+				      fabs(X[bin]) :
+				      sqrtf(X[bin] * X[bin] +
+					    X[n_points - bin] * X[n_points - bin]));
+		if (row && !waterfall_bins)
+			row[i] = level[i];
+	}
 
 	/* FFT bins (fftw output) to display's freq-band bars */
+	if (!ntones || (features && !an->skim))
+		an->kernels.power(X, s->power, n_points);
+	if (features && !an->skim)
+		spectral_features(d, channel, s->power);
 	bin = 1;
-	memset(ddata, 0, sizeof(ddata));
-	for (i = 0; i < NE_GLPROG_FBANDS; i++) {
+	for (i = ntones ? an->nbands : 0; i < an->nbands; i++) {
 
 		count = 0;
 		offset = bin;
-		while (bin < (n_points / 2) && bin_band[bin] <= i) {
+		while (bin < (n_points / 2) && an->bin_band[bin] <= i) {
 			count++;
 			bin++;
 		}
 
+		tmp = 0.0f;
 		if (count) {
 
 			/* obtain raw freq band bar magnitude */
-			magn = freq_band_magn(offset, count);
-
-			/* calibration is maddening */
-			tmp = magn > 0.0f ? logf(magn) * 16.7f : 0.0f;
-      tmp = tmp > 172.0f ? (tmp - 172.0f) * 3.2f : 0.0f;
-			/* clip excessive levels */
-			tmp = tmp < 250.0f ? tmp : 250.0f;
-
-			/* control rate of decay */
-			/* first establish special case */
-			prevtmp[i] = prevtmp[i] > 2.0f ? 
-					prevtmp[i] - (2.0f * logf(prevtmp[i])) : 0.0f;
-			/* then handle general case */
-			if(tmp > prevtmp[i])
-				prevtmp[i] = tmp;
-			else
-				tmp = prevtmp[i];
+			magn = freq_band_magn(s->power, offset, count);
+
+			tmp = magn_calib(magn);
+			if (row && !waterfall_bins)
+				row[i] = tmp;
 
-			ddata[i].fband_magn = tmp;
 			prdbg
-			    ("FREQ_BAND: %d, bin_count: %d, display_fband_magn: %.2f, raw_fband_magn: %.2f, logf(raw_fband_magn): %.2f\n",
-			     i, count, ddata[i].fband_magn, magn, logf(magn));
+			    ("FREQ_BAND: %d, bin_count: %d, fband_magn: %.2f, raw_fband_magn: %.2f, logf(raw_fband_magn): %.2f\n",
+			     i, count, tmp, magn, logf(magn));
 		}
+		level[i] = tmp;
 	}
 
-	/* copy display data to posix shm */
-	memcpy(map, ddata, sizeof(ddata));
+	if (row)
+		waterfall_commit(d);
 }
 
-/* ====================================================== *
- *                    INITIALIZATION                      *
- * ====================================================== */
-
-static int fft_init(void)
+/* func : do_fft()
+ * desc : performs fft processing on a given channel 
+ * notes: for simultaneous fft processing on stereo signals, see (for example)
+ *        "http://nairobi-embedded.org/ne_fft_notes.html" and do_fft_pair()
+ */
+static inline int do_fft(struct ne_capture_dev *d, struct ne_scratch *s,
+			 int channel)
 {
-	int i, bin, n_points = hwparams.period_frames;
-	float base_freq_ratio;
+	struct ne_analysis *an = d->an;
+	int n_points = an->n_points;
+	fftw_real *X = spectrum_out(d, channel, s->cplx);
 
-	/* fftw initialization */
-	real = calloc(n_points, sizeof(fftw_real));
-	cplx = calloc(n_points, sizeof(fftw_real));
-	bin_band = calloc(n_points, sizeof(int));
-	window = calloc(n_points, sizeof(double));
-	if (!real || !cplx || !bin_band || !window) {
-		prerr("calloc(3) failed!\n");
-		return -1;
-	}
+	/* initialize fftw input buffer */
+	an->kernels.window(an->chnldata + channel * n_points, an->tune->window,
+			   s->real, n_points);
+
+	/* fftw real->complex transform */
 #ifdef FFTW3
-	plan_rc =
-	    fftwf_plan_r2r_1d(n_points, real, cplx, FFTW_R2HC, FFTW_MEASURE);
+	fftwf_execute_r2r(an->plan_rc, s->real, X);
 #else
-	plan_rc =
-	    rfftw_create_plan(n_points, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE);
+	rfftw_one(an->plan_rc, s->real, X);
 #endif
 
-	for (i = 0; i < n_points; i++)
-		window[i] = 1.0f;	/* place-holder */
+	fft_bands(d, s, channel, X);
+	return 1;
+}
 
-	/* prepare for grouping of fft bins into display freq bars */
-	hz_per_bin = (float)hwparams.rate / (float)n_points;
-	bin = 1;
-	while (bin <= ne_glprog_fband[0] / hz_per_bin)
-		bin_band[bin++] = 0;
+/* func : do_fft_pair()
+ * desc : two real channels "a" and "b" for the price of one complex fft:
+ *        Z = fft(a + jb), then A[k] = (Z[k] + Z*[N-k]) / 2 and
+ *        B[k] = (Z[k] - Z*[N-k]) / 2j, stored halfcomplex as do_fft()'s
+ */
+static inline int do_fft_pair(struct ne_capture_dev *d, struct ne_scratch *s,
+			      int channel)
+{
+	struct ne_analysis *an = d->an;
+	int k, n_points = an->n_points;
+	const float *a = an->chnldata + channel * n_points;
+	const float *b = a + n_points;
+	fftw_real *XA, *XB, *z = s->zout;
+	fftw_real zr, zi, mr, mi;
 
-	for (i = 1;
-	     i < NE_GLPROG_FBANDS - 1 && bin < (n_points / 2) - 1
-	     && ne_glprog_fband[i + 1] < hwparams.rate / 2; i++) {
-		base_freq_ratio = (ne_glprog_fband[i + 1]) / hz_per_bin;
-		while (bin <= base_freq_ratio)
-			bin_band[bin++] = i;
-	}
+	if (channel + 1 >= (int)an->analyze_channels)
+		return do_fft(d, s, channel);
 
-	for (; bin < (n_points / 2); bin++)
-		bin_band[bin] = NE_GLPROG_FBANDS - 1;
+	an->kernels.window2(a, b, an->tune->window, s->zin, n_points);
+#ifdef FFTW3
+	fftwf_execute_dft(an->plan_cc, (fftwf_complex *)s->zin,
+			  (fftwf_complex *)s->zout);
+#else
+	fftw_one(an->plan_cc, (fftw_complex *)s->zin, (fftw_complex *)s->zout);
+#endif
 
-	return 0;
+	XA = spectrum_out(d, channel, s->cplx);
+	XB = spectrum_out(d, channel + 1, s->cplx2);
+	XA[0] = z[0];
+	XB[0] = z[1];
+	for (k = 1; k < (n_points + 1) / 2; k++) {
+		zr = z[2 * k];
+		zi = z[2 * k + 1];
+		mr = z[2 * (n_points - k)];
+		mi = z[2 * (n_points - k) + 1];
+		XA[k] = 0.5f * (zr + mr);
+		XA[n_points - k] = 0.5f * (zi - mi);
+		XB[k] = 0.5f * (zi + mi);
+		XB[n_points - k] = -0.5f * (zr - mr);
+	}
+	if (!(n_points % 2)) {
+		XA[n_points / 2] = z[n_points];
+		XB[n_points / 2] = z[n_points + 1];
+	}
+
+	fft_bands(d, s, channel, XA);
+	fft_bands(d, s, channel + 1, XB);
+	return 2;
 }
 
-static void *shm_init(const char *const filename, size_t filesize)
+/*
+ * Goertzel: the magnitude of just the "-T" tone frequencies over the
+ * period, about ntones * n_points multiply-adds. The tone loop is inner
+ * so that it vectorizes across tones; double state keeps low tones
+ * (coefficient close to 2) accurate over long periods.
+ */
+static inline int do_goertzel(struct ne_capture_dev *d, struct ne_scratch *s,
+			      int channel)
 {
-	int fd, ret = -1;
-	void *map = NULL;
+	struct ne_analysis *an = d->an;
+	int i, t, n_points = an->n_points;
+	const float *x = an->chnldata + channel * n_points;
+	const double *__restrict coef = an->tone_coef;
+	const double *__restrict win = an->tune->window;
+	double *__restrict s1 = s->tone_s1;
+	double *__restrict s2 = s->tone_s2;
+	double v, s0, power;
+	float *level = an->band_level + channel * an->nbands;
+	float *row = channel == 0 ? waterfall_row(d) : NULL;
 
-	fd = shm_open(filename, O_RDWR | O_CREAT, (mode_t) 0666);
-	if (fd < 0) {
-		prerr("%s\n", strerror(errno));
+	for (t = 0; t < ntones; t++)
+		s1[t] = s2[t] = 0.0;
+
+	for (i = 0; i < n_points; i++) {
+		v = x[i] * win[i];
+		for (t = 0; t < ntones; t++) {
+			s0 = v + coef[t] * s1[t] - s2[t];
+			s2[t] = s1[t];
+			s1[t] = s0;
+		}
+	}
+
+	/* |X(w)|^2 = s1^2 + s2^2 - 2cos(w) s1 s2, same scale as the fft's */
+	for (t = 0; t < ntones; t++) {
+		power = s1[t] * s1[t] + s2[t] * s2[t] - coef[t] * s1[t] * s2[t];
+		level[t] = magn_calib(sqrtf(power > 0.0 ? power : 0.0));
+		if (row)
+			row[t] = level[t];
+	}
+
+	if (row)
+		waterfall_commit(d);
+	return 1;
+}
+
+/*
+ * Low-pass and halve the rate of "n" samples, continuing from the
+ * previous call's delay line and parity. Only the centre and odd taps
+ * of a half-band filter are non-zero. Returns the output count.
+ */
+static inline int halfband_decimate(float *delay, int *phase, const float *in,
+				    int n, float *work, float *out)
+{
+	int i, j, m = 0, c = NE_HALFBAND_TAPS / 2;
+	const int len = NE_HALFBAND_TAPS - 1;
+	const float *x;
+	float acc;
+
+	memcpy(work, delay, len * sizeof(float));
+	memcpy(work + len, in, n * sizeof(float));
+
+	/* x[len] is input sample i */
+	for (i = *phase; i < n; i += 2) {
+		x = work + i;
+		acc = halfband[c] * x[c];
+		for (j = !(c & 1); j < NE_HALFBAND_TAPS; j += 2)
+			acc += halfband[j] * x[j];
+		out[m++] = acc;
+	}
+	*phase = (*phase + n) & 1;
+	memcpy(delay, work + n, len * sizeof(float));
+	return m;
+}
+
+/* fft of one octave's history, into the levels of the bands it holds */
+static inline void octave_bands(struct ne_capture_dev *d, struct ne_scratch *s,
+				int octave, const float *hist, float *level)
+{
+	struct ne_analysis *an = d->an;
+	int i, bin;
+	const int M = NE_OCTAVE_POINTS;
+	/* to the full-rate fft's magnitude scale, Hann coherent gain 0.5 */
+	const float scale = 2.0f * an->n_points / M;
+	fftw_real re, im, magn, peak;
+
+	for (i = 0; i < M; i++)
+		s->oct_real[i] = hist[i] * an->oct_window[i];
+#ifdef FFTW3
+	fftwf_execute_r2r(an->plan_oct, s->oct_real, s->oct_cplx);
+#else
+	rfftw_one(an->plan_oct, s->oct_real, s->oct_cplx);
+#endif
+
+	for (i = 0; i < an->nbands; i++) {
+		if (an->band_octave[i] != octave)
+			continue;
+		peak = 0.0f;
+		for (bin = an->band_lo[i]; bin <= an->band_hi[i]; bin++) {
+			re = s->oct_cplx[bin];
+			im = s->oct_cplx[M - bin];
+			magn = sqrt(re * re + im * im);
+			peak = magn > peak ? magn : peak;
+		}
+		level[i] = magn_calib(scale * peak);
+	}
+}
+
+/*
+ * Octave engine: decimate the period octave by octave; an octave's fft
+ * is redone once a quarter of its history is new, so the slow low
+ * octaves cost little. Bands of the other octaves keep their levels.
+ */
+static inline int do_octave(struct ne_capture_dev *d, struct ne_scratch *s,
+			    int channel)
+{
+	struct ne_analysis *an = d->an;
+	int i, k, n = an->fresh, o;
+	const int M = NE_OCTAVE_POINTS;
+	/* all of the resampler's output, or the period */
+	const float *src = an->rs_up ? an->rs_out + channel * an->fresh_max :
+	    an->chnldata + channel * an->n_points;
+	float *hist, *dst;
+	float *level = an->band_level + channel * an->nbands;
+	float *row = channel == 0 ? waterfall_row(d) : NULL;
+
+	for (k = 0; k < an->octaves && n > 0; k++) {
+		o = channel * an->octaves + k;
+		if (k) {
+			dst = s->oct_buf[k & 1];
+			n = halfband_decimate(an->oct_delay +
+					      o * (NE_HALFBAND_TAPS - 1),
+					      &an->oct_phase[o], src, n,
+					      s->oct_work, dst);
+			src = dst;
+		}
+
+		/* slide the history along */
+		hist = an->oct_hist + o * M;
+		if (n >= M)
+			memcpy(hist, src + n - M, M * sizeof(float));
+		else {
+			memmove(hist, hist + n, (M - n) * sizeof(float));
+			memcpy(hist + M - n, src, n * sizeof(float));
+		}
+
+		an->oct_fresh[o] += n;
+		if (an->oct_fresh[o] < M / 4)
+			continue;
+		an->oct_fresh[o] = 0;
+		octave_bands(d, s, k, hist, level);
+	}
+
+	if (row) {
+		for (i = 0; i < an->nbands; i++)
+			row[i] = level[i];
+		waterfall_commit(d);
+	}
+	return 1;
+}
+
+/*
+ * Zoom engine: mix the period's new samples down by the zoom centre,
+ * low-pass and decimate them (re and im alike, through the resampling
+ * kernel), slide them into the channel's history and fft that. Without
+ * new decimated samples the bands keep their levels.
+ */
+static inline int do_zoom(struct ne_capture_dev *d, struct ne_scratch *s,
+			  int channel)
+{
+	struct ne_analysis *an = d->an;
+	int i, k, m = 0, pos, phase, bin;
+	int n = an->fresh, len = an->zoom_taps - 1;
+	const int M = zoom_points;
+	/* all of the resampler's output, or the period */
+	const float *x = an->rs_up ? an->rs_out + channel * an->fresh_max :
+	    an->chnldata + channel * an->n_points;
+	float *delay = an->zoom_delay + (size_t)channel * 2 * len;
+	float *hist = an->zoom_hist + (size_t)channel * 2 * M, *h;
+	const double *win = an->tune->zoom_window;
+	float *level = an->band_level + channel * an->nbands;
+	float *row = channel == 0 ? waterfall_row(d) : NULL;
+	/* to the full-rate fft's magnitude scale, A N / 2 for a tone of
+	 * amplitude A: A / 2 of it is mixed down, the window is at unit
+	 * gain */
+	const float scale = (float)an->n_points / M;
+	double w = -2.0 * M_PI * zoom_hz / an->rate;
+	double c = cos(an->zoom_phase[channel]);
+	double sn = sin(an->zoom_phase[channel]);
+	double cw = cos(w), sw = sin(w), t;
+	fftw_real re, im, power, peak;
+
+	/* x e^(-j w n), the oscillator turned sample by sample and set anew
+	 * from the phase every period */
+	for (i = 0; i < n; i++) {
+		s->zoom_work[0][len + i] = x[i] * c;
+		s->zoom_work[1][len + i] = x[i] * sn;
+		t = c * cw - sn * sw;
+		sn = sn * cw + c * sw;
+		c = t;
+	}
+	an->zoom_phase[channel] = fmod(an->zoom_phase[channel] + n * w,
+				       2.0 * M_PI);
+
+	for (k = 0; k < 2; k++) {
+		memcpy(s->zoom_work[k], delay + k * len, len * sizeof(float));
+		pos = an->zoom_pos[channel];
+		phase = 0;
+		m = an->zoom_fir(s->zoom_work[k], n, an->zoom_coef,
+				 an->zoom_taps, 1, an->zoom_decim, &pos, &phase,
+				 s->zoom_dec[k]);
+		memcpy(delay + k * len, s->zoom_work[k] + n,
+		       len * sizeof(float));
+
+		/* slide the history along */
+		h = hist + k * M;
+		if (m >= M)
+			memcpy(h, s->zoom_dec[k] + m - M, M * sizeof(float));
+		else {
+			memmove(h, h + m, (M - m) * sizeof(float));
+			memcpy(h + M - m, s->zoom_dec[k], m * sizeof(float));
+		}
+	}
+	an->zoom_pos[channel] = pos;
+
+	if (m) {
+		for (i = 0; i < M; i++) {
+			s->zoom_z[2 * i] = hist[i] * win[i];
+			s->zoom_z[2 * i + 1] = hist[M + i] * win[i];
+		}
+#ifdef FFTW3
+		fftwf_execute_dft(an->plan_zoom, (fftwf_complex *)s->zoom_z,
+				  (fftwf_complex *)s->zoom_zout);
+#else
+		fftw_one(an->plan_zoom, (fftw_complex *)s->zoom_z,
+			 (fftw_complex *)s->zoom_zout);
+#endif
+
+		/* bin k of the span is fft bin k - M/2, modulo M */
+		for (i = 0; i < an->nbands; i++) {
+			peak = 0.0f;
+			for (k = an->band_lo[i]; k <= an->band_hi[i]; k++) {
+				bin = (k + M / 2) % M;
+				re = s->zoom_zout[2 * bin];
+				im = s->zoom_zout[2 * bin + 1];
+				power = re * re + im * im;
+				peak = power > peak ? power : peak;
+			}
+			level[i] = magn_calib(scale * sqrt(peak));
+		}
+	}
+
+	if (row) {
+		for (i = 0; i < an->nbands; i++)
+			row[i] = level[i];
+		waterfall_commit(d);
+	}
+	return 1;
+}
+
+/*
+ * Q15 engine: the N-point real fft as an N/2-point complex radix-2 fft
+ * of the even/odd samples plus a split pass, all in 16-bit fixed point
+ * with block floating point. Before each stage the block is shifted
+ * right until its largest part is below 2^13, so no butterfly (gain at
+ * most 1 + sqrt(2)) can overflow; the shifts are summed in an exponent.
+ * The split pass and the bin powers are 32/64-bit, and floats appear
+ * only once per band, for the calibration.
+ *
+ * Accuracy: the rounding noise of the shifts and Q15 products sits
+ * about 70 dB below the loudest bin of the period for up to 4096 points
+ * (12 stages), and rises with every further stage, hence the limit.
+ * Against the float path, measured with "--bench" on tones from -6 to
+ * -60 dBFS plus noise: bands within 30 dB of the loudest bin are within
+ * 1 display unit (0.16 dB), bands 50 dB down within about 5 units, and
+ * bands near the display floor can read a few units high.
+ */
+#define Q15_MUL(a, b) ((int32_t)(((int32_t)(a) * (b) + (1 << 14)) >> 15))
+
+static inline int q15_max(const int16_t *z, int n)
+{
+	int i, m = 0, v;
+
+	for (i = 0; i < n; i++) {
+		v = z[i] < 0 ? -z[i] : z[i];
+		m = v > m ? v : m;
+	}
+	return m;
+}
+
+static inline int q15_fft(struct ne_capture_dev *d, struct ne_scratch *s)
+{
+	struct ne_analysis *an = d->an;
+	int i, j, h, step, sh, exp = 0, half = an->n_points / 2;
+	int16_t *z = s->q15_z;
+	const int16_t *tw = an->q15_tw;
+	int32_t ar, ai, br, bi, tr, ti;
+	int m = q15_max(z, 2 * half);
+
+	/* use the headroom of quiet blocks too */
+	if (!m)
+		return 0;
+	for (sh = 0; m < (1 << 12); sh++)
+		m <<= 1;
+	if (sh) {
+		for (i = 0; i < 2 * half; i++)
+			z[i] <<= sh;
+		exp -= sh;
+	}
+
+	for (h = 1, step = half; h < half; h <<= 1, step >>= 1) {
+		sh = m >= (1 << 14) ? 2 : m >= (1 << 13) ? 1 : 0;
+		exp += sh;
+		m = 0;
+		for (i = 0; i < half; i += 2 * h) {
+			for (j = 0; j < h; j++) {
+				const int16_t *w = tw + 2 * j * step;
+				int16_t *a = z + 2 * (i + j), *b = a + 2 * h;
+
+				ar = a[0] >> sh;
+				ai = a[1] >> sh;
+				br = b[0] >> sh;
+				bi = b[1] >> sh;
+				tr = Q15_MUL(br, w[0]) - Q15_MUL(bi, w[1]);
+				ti = Q15_MUL(br, w[1]) + Q15_MUL(bi, w[0]);
+				a[0] = ar + tr;
+				a[1] = ai + ti;
+				b[0] = ar - tr;
+				b[1] = ai - ti;
+			}
+		}
+		m = q15_max(z, 2 * half);
+	}
+	return exp;
+}
+
+static inline int do_q15(struct ne_capture_dev *d, struct ne_scratch *s,
+			 int channel)
+{
+	struct ne_analysis *an = d->an;
+	int i, k, bin, exp, n_points = an->n_points;
+	int half = n_points / 2;
+	const int16_t *x = an->q15_in + channel * n_points;
+	const int16_t *z = s->q15_z;
+	const int16_t *win = an->tune->q15_window;
+	const float gain = an->tune->q15_gain;
+	int64_t *P = s->q15_power, peak;
+	int32_t zr, zi, mr, mi, er, ei, orr, oi, tr, ti, xr, xi;
+	float *level = an->band_level + channel * an->nbands;
+	float *row = channel == 0 ? waterfall_row(d) : NULL;
+
+	/* windowed even/odd samples as re/im, in bit-reversed order */
+	for (i = 0; i < half; i++) {
+		s->q15_z[2 * an->q15_bitrev[i]] =
+		    Q15_MUL(x[2 * i], win[2 * i]);
+		s->q15_z[2 * an->q15_bitrev[i] + 1] =
+		    Q15_MUL(x[2 * i + 1], win[2 * i + 1]);
+	}
+	exp = q15_fft(d, s);
+
+	/* split: X[k] = E[k] + W^k O[k], E/O from Z[k] and Z*[N/2-k] */
+	P[0] = (int64_t)(z[0] + z[1]) * (z[0] + z[1]);
+	P[half] = (int64_t)(z[0] - z[1]) * (z[0] - z[1]);
+	for (k = 1; k < half; k++) {
+		zr = z[2 * k];
+		zi = z[2 * k + 1];
+		mr = z[2 * (half - k)];
+		mi = -z[2 * (half - k) + 1];
+		er = zr + mr;
+		ei = zi + mi;
+		orr = zi - mi;
+		oi = mr - zr;
+		tr = Q15_MUL(orr, an->q15_tw[2 * k]) -
+		    Q15_MUL(oi, an->q15_tw[2 * k + 1]);
+		ti = Q15_MUL(orr, an->q15_tw[2 * k + 1]) +
+		    Q15_MUL(oi, an->q15_tw[2 * k]);
+		/* 2X; the halving goes into the exponent */
+		xr = er + tr;
+		xi = ei + ti;
+		P[k] = (int64_t)xr * xr + (int64_t)xi * xi;
+	}
+	/* P[0], P[half] hold X^2; P[k] holds (2X)^2 */
+	P[0] <<= 2;
+	P[half] <<= 2;
+	exp -= 1;
+
+	for (i = 0; i < ntones; i++)
+		level[i] = magn_calib(gain *
+				      ldexpf(sqrtf((float)P[an->tone_bin[i]]),
+					     exp));
+
+	/* bin_band grouping and peak picking as in fft_bands() */
+	bin = 1;
+	for (i = ntones ? an->nbands : 0; i < an->nbands; i++) {
+		peak = 0;
+		while (bin < half && an->bin_band[bin] <= i) {
+			peak = P[bin] > peak ? P[bin] : peak;
+			bin++;
+		}
+		level[i] = magn_calib(gain *
+				      ldexpf(sqrtf((float)peak), exp));
+	}
+
+	if (row) {
+		for (i = 0; i < an->nbands; i++)
+			row[i] = level[i];
+		waterfall_commit(d);
+	}
+	return 1;
+}
+
+/* "--features" peak and rms of "count" channels from "channel" on, while
+ * their samples are still in cache from the engine */
+static inline void level_features(struct ne_capture_dev *d, int channel,
+				  int count)
+{
+	struct ne_analysis *an = d->an;
+	int n_points = an->n_points;
+	struct ne_fanout_features *f;
+	float peak;
+	double sumsq;
+
+	for (; count--; channel++) {
+		f = &an->feat[channel];
+		if (gate) {
+			peak = an->ch_peak[channel];
+			sumsq = an->ch_sumsq[channel];
+		} else
+			an->kernels.stats(an->chnldata + channel * n_points,
+					  n_points, &peak, &sumsq);
+		f->peak = peak / an->full_scale;
+		f->rms = sqrt(sumsq / n_points) / an->full_scale;
+	}
+}
+
+/*
+ * "--gate": a gated channel's engine call. Its levels drop to zero so
+ * that the ballistics release its bands, its spectrum slot and
+ * waterfall row are zeroed, and its features are those of silence.
+ * With "--fft-pairs" both channels of a pair are skipped.
+ */
+static inline int gate_skip(struct ne_capture_dev *d, int channel)
+{
+	struct ne_analysis *an = d->an;
+	int c, n = fft_pairs && an->engine == NE_ENGINE_FFT &&
+	    channel + 1 < (int)an->analyze_channels ? 2 : 1;
+	struct ne_alsa_spectrum *sp = an->due ? an->spectrum_map : NULL;
+	float *row;
+
+	for (c = channel; c < channel + n; c++) {
+		memset(an->band_level + c * an->nbands, 0,
+		       an->nbands * sizeof(float));
+		if (sp)
+			memset((fftw_real *)sp->data +
+			       (((sp->seq + 1) & 1) * (size_t)sp->channels + c) *
+			       sp->nvals, 0, sp->nvals * sizeof(fftw_real));
+		if (c == 0 && (row = waterfall_row(d))) {
+			memset(row, 0, an->waterfall_map->cols * sizeof(float));
+			waterfall_commit(d);
+		}
+		if (features && !an->skim) {
+			an->feat[c].centroid_hz = an->feat[c].rolloff_hz = 0.0f;
+			an->feat[c].flux = an->feat[c].onset = 0.0f;
+		}
+	}
+	return n;
+}
+
+/* one engine call, on whichever thread runs it */
+static inline int analyze_channel(struct ne_capture_dev *d,
+				  struct ne_scratch *s, int channel)
+{
+	struct ne_analysis *an = d->an;
+	int64_t t = 0;
+	int n;
+
+	stage_lap(d, &t);
+	if (gate && an->gated[channel] && (!fft_pairs || an->engine !=
+					   NE_ENGINE_FFT || channel + 1 >=
+					   (int)an->analyze_channels ||
+					   an->gated[channel + 1]))
+		n = gate_skip(d, channel);
+	else
+		n = an->analyze(d, s, channel);
+	if (features && !an->skim)
+		level_features(d, channel, n);
+	NE_PROBE(analyze, d->index, d->period_count, channel,
+		 stage_lap(d, &t));
+	return n;
+}
+
+/*
+ * Ballistics: attack/release smoothing with peak hold of every band of
+ * every analyzed channel in one pass. A rising level is followed at the
+ * attack rate and re-arms the hold; a falling one is held, then decays
+ * at the release rate. Written without branches so that it vectorizes.
+ */
+static inline void do_ballistics(struct ne_capture_dev *d, int lo, int hi)
+{
+	struct ne_analysis *an = d->an;
+	int i;
+	const float *__restrict in = an->band_level;
+	float *__restrict out = an->band_out;
+	float *__restrict hold = an->band_hold;
+	const float ca = an->tune->attack_coef;
+	const float cr = an->tune->release_coef;
+	const float hp = an->tune->hold_periods;
+	float x, y, h, c;
+
+	for (i = lo; i < hi; i++) {
+		x = in[i];
+		y = out[i];
+		h = hold[i] - 1.0f;
+		h = h > 0.0f ? h : 0.0f;
+		c = h > 0.0f ? 1.0f : cr;
+		c = x >= y ? ca : c;
+		hold[i] = x >= y ? hp : h;
+		out[i] = x + c * (y - x);
+	}
+}
+
+/* "--features" of the periods folded by publish_fold(): the largest peak,
+ * any onset, the rest as of the latest period */
+static inline void features_fold(struct ne_capture_dev *d, int first)
+{
+	struct ne_analysis *an = d->an;
+	unsigned int ch;
+	struct ne_fanout_features *acc, *f;
+
+	for (ch = 0; ch < an->analyze_channels; ch++) {
+		acc = &an->feat_acc[ch];
+		f = &an->feat[ch];
+		if (first) {
+			*acc = *f;
+			continue;
+		}
+		acc->peak = f->peak > acc->peak ? f->peak : acc->peak;
+		acc->rms = f->rms;
+		acc->centroid_hz = f->centroid_hz;
+		acc->rolloff_hz = f->rolloff_hz;
+		acc->flux = f->flux;
+		acc->onset = f->onset > acc->onset ? f->onset : acc->onset;
+	}
+}
+
+/*
+ * Whether to publish this period, as do_capture() found: only on
+ * "--publish-rate" ticks, and only the last of a catch-up batch. The
+ * periods in between are folded into the max (or sum, for the mean of
+ * "--publish-mode") per band, so that a transient is never lost, and the
+ * publish shows that in place of this period's bands. Publishing every
+ * period costs no copies.
+ */
+static inline int publish_fold(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int i, n = an->analyze_channels * an->nbands;
+	float *__restrict fold = an->band_fold;
+	const float *__restrict out = an->band_out;
+	int64_t now = d->capture_tstamp_ns;
+
+	if (an->due && !an->folded) {
+		an->band_pub = an->band_out;
+		an->feat_pub = an->feat;
+		an->pub_periods = 1;
+	} else {
+		/* skimmed periods have no features to fold */
+		if (features && !an->skim)
+			features_fold(d, !an->feat_folded++);
+		if (!an->folded++)
+			memcpy(fold, out, n * sizeof(float));
+		else if (publish_mode == NE_PUBLISH_MEAN)
+			for (i = 0; i < n; i++)
+				fold[i] += out[i];
+		else
+			for (i = 0; i < n; i++)
+				fold[i] = out[i] > fold[i] ? out[i] : fold[i];
+		if (!an->due)
+			return 0;
+		if (publish_mode == NE_PUBLISH_MEAN)
+			for (i = 0; i < n; i++)
+				fold[i] /= an->folded;
+		an->band_pub = fold;
+		an->feat_pub = an->feat_acc;
+		an->pub_periods = an->folded;
+		an->folded = 0;
+		an->feat_folded = 0;
+	}
+
+	if (publish_rate) {
+		d->publish_ns += 1e9 / publish_rate;
+		if (d->publish_ns <= now)
+			d->publish_ns = now + 1e9 / publish_rate;
+	}
+	return 1;
+}
+
+/* channel 0's smoothed bands to "ne_glprog" */
+static inline void bands_publish(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int i;
+
+	for (i = 0; i < an->nbands; i++)
+		d->ddata[i].fband_magn = an->band_pub[i];
+
+	/* copy display data to posix shm */
+	memcpy(d->ne_glprog_fband_data_map, d->ddata,
+	       an->nbands * sizeof(d->ddata[0]));
+}
+
+/* ====================================================== *
+ *                    INITIALIZATION                      *
+ * ====================================================== */
+
+/*
+ * Fill "w" with "n" points of the "--window", periodic as suits an fft;
+ * returns its coherent gain (mean value).
+ */
+static double window_fill(double *w, int n)
+{
+	int i;
+	double x, sum = 0.0;
+
+	for (i = 0; i < n; i++) {
+		x = 2.0 * M_PI * i / n;
+		switch (window_kind) {
+		case NE_WINDOW_HANN:
+			w[i] = 0.5 - 0.5 * cos(x);
+			break;
+		case NE_WINDOW_HAMMING:
+			w[i] = 0.54 - 0.46 * cos(x);
+			break;
+		case NE_WINDOW_BLACKMAN:
+			w[i] = 0.42 - 0.5 * cos(x) + 0.08 * cos(2.0 * x);
+			break;
+		default:
+			w[i] = 1.0;
+		}
+		sum += w[i];
+	}
+	return sum / n;
+}
+
+/* the engine's window into "tn", the coherent gain divided out so that
+ * a tone reads the same level whatever the window */
+static void window_init(const struct ne_capture_dev *d, struct ne_tuning *tn)
+{
+	const struct ne_analysis *an = d->an;
+	int i, n = an->engine == NE_ENGINE_ZOOM ? zoom_points : an->n_points;
+	double *w = an->engine == NE_ENGINE_ZOOM ? tn->zoom_window : tn->window;
+	double gain;
+
+	if (an->engine == NE_ENGINE_OCTAVE)
+		return;
+	gain = window_fill(w, n);
+	if (an->engine == NE_ENGINE_Q15) {
+		for (i = 0; i < n; i++)
+			tn->q15_window[i] = lrint(32767.0 * w[i]);
+		tn->q15_gain = 1.0 / gain;
+		return;
+	}
+	for (i = 0; i < n; i++)
+		w[i] /= gain;
+}
+
+static void bin_band_init(struct ne_capture_dev *d);
+static int fft_init(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int n_points = an->n_points;
+
+	/* fftw initialization, buffers come from the device arena */
+#ifdef FFTW3
+	/* unaligned: the output may be redirected into the shm spectrum */
+	an->plan_rc =
+	    fftwf_plan_r2r_1d(n_points, an->scratch[0].real,
+			      an->scratch[0].cplx, FFTW_R2HC,
+			      FFTW_MEASURE | FFTW_UNALIGNED);
+#else
+	an->plan_rc =
+	    rfftw_create_plan(n_points, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE);
+#endif
+	if (fft_pairs) {
+#ifdef FFTW3
+		an->plan_cc =
+		    fftwf_plan_dft_1d(n_points,
+				      (fftwf_complex *)an->scratch[0].zin,
+				      (fftwf_complex *)an->scratch[0].zout,
+				      FFTW_FORWARD,
+				      FFTW_MEASURE);
+#else
+		an->plan_cc =
+		    fftw_create_plan(n_points, FFTW_FORWARD, FFTW_ESTIMATE);
+#endif
+	}
+
+	bin_band_init(d);
+	return 0;
+}
+
+/* prepare for grouping of fft bins into display freq bars */
+static void bin_band_init(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int i, bin, n_points = an->n_points;
+	float base_freq_ratio;
+
+	an->hz_per_bin = (float)an->rate / (float)n_points;
+	bin = 1;
+	while (bin <= an->fband_hz[0] / an->hz_per_bin)
+		an->bin_band[bin++] = 0;
+
+	for (i = 1;
+	     i < an->nbands - 1 && bin < (n_points / 2) - 1
+	     && an->fband_hz[i + 1] < an->rate / 2; i++) {
+		base_freq_ratio = (an->fband_hz[i + 1]) / an->hz_per_bin;
+		while (bin <= base_freq_ratio)
+			an->bin_band[bin++] = i;
+	}
+
+	for (; bin < (n_points / 2); bin++)
+		an->bin_band[bin] = an->nbands - 1;
+}
+
+/* twiddles and bit-reversal table for the q15 engine */
+static void q15_init(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int i, j, bits, n_points = an->n_points;
+	int half = n_points / 2;
+
+	for (i = 0; i < half; i++) {
+		an->q15_tw[2 * i] =
+		    lrint(32767.0 * cos(2.0 * M_PI * i / n_points));
+		an->q15_tw[2 * i + 1] =
+		    lrint(-32767.0 * sin(2.0 * M_PI * i / n_points));
+	}
+	for (bits = 0; (1 << bits) < half; bits++)
+		;
+	for (i = 0; i < half; i++) {
+		for (an->q15_bitrev[i] = 0, j = 0; j < bits; j++)
+			if (i & (1 << j))
+				an->q15_bitrev[i] |= 1 << (bits - 1 - j);
+	}
+	bin_band_init(d);
+}
+
+/* sample conversion, window and fft power kernels for this stream; a
+ * planar period converts one channel plane at a time */
+static void kernels_init(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	snd_pcm_format_t format = d->hwparams.format;
+	int bytes = snd_pcm_format_physical_width(format) / 8;
+	struct ne_kernels *k = &an->kernels;
+
+	d->frame_bytes = bytes * d->hwparams.channels;
+	an->full_scale = ldexpf(1.0f, snd_pcm_format_width(format) - 1);
+	ne_kernels_select(k, bytes, snd_pcm_format_width(format),
+			  snd_pcm_format_big_endian(format) == 1,
+			  d->planar ? 1 : d->hwparams.channels,
+			  an->n_points, an->rs_taps);
+	/* unsigned and non-linear formats keep the byte-by-byte path */
+	if (snd_pcm_format_signed(format) != 1
+	    || snd_pcm_format_linear(format) != 1)
+		k->deint = NULL;
+
+	if (!verbose)
+		printf("\n" "DSP Kernels:" "\n%*s (sample conversion%s)"
+		       "\n%*s (fft window, power)" "\n", 30,
+		       !k->deint ? "byte-wise" :
+		       k->deint_fixed ? "specialized" : "generic",
+		       d->planar ? ", planar" : "", 30,
+		       k->n_fixed ? "specialized" : "generic");
+	if (!verbose && an->rs_up)
+		printf("%*s (resampler)" "\n", 30,
+		       k->taps_fixed ? "specialized" : "generic");
+}
+
+/*
+ * Turn the ballistics times into per-period factors: a one-pole
+ * exp(-T/tau) for attack and release, and the hold as a period count,
+ * so the response is the same whatever the period size or rate.
+ */
+static void ballistics_init(const struct ne_capture_dev *d,
+			    struct ne_tuning *tn)
+{
+	float period_ms = 1000.0f * d->hwparams.period_frames /
+	    d->hwparams.rate;
+
+	tn->attack_coef = attack_ms > 0.0f ?
+	    expf(-period_ms / attack_ms) : 0.0f;
+	tn->release_coef = release_ms > 0.0f ?
+	    expf(-period_ms / release_ms) : 0.0f;
+	tn->hold_periods = hold_ms / period_ms;
+}
+
+/* task counts of each phase; workers start with the capture thread */
+static void pool_init(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+
+	an->step = an->analyze == do_fft_pair ? 2 : 1;
+	an->ntasks[NE_POOL_ANALYZE] =
+	    (an->analyze_channels + an->step - 1) / an->step;
+	an->ntasks[NE_POOL_BALLISTICS] = (an->analyze_channels * an->nbands +
+					  NE_POOL_CHUNK - 1) / NE_POOL_CHUNK;
+
+	if (!verbose && dsp_threads)
+		printf("\n" "DSP Pool:" "\n%*d workers + capture thread"
+		       "\n%*u analyze, %u ballistics tasks per period" "\n",
+		       30, dsp_threads, 30, an->ntasks[NE_POOL_ANALYZE],
+		       an->ntasks[NE_POOL_BALLISTICS]);
+}
+
+/* windowed-sinc half-band low-pass, unity gain at DC */
+static void halfband_init(void)
+{
+	int i, c = NE_HALFBAND_TAPS / 2;
+	double w, sum = 0.0;
+
+	for (i = 0; i < NE_HALFBAND_TAPS; i++) {
+		/* Blackman */
+		w = 0.42 - 0.5 * cos(2.0 * M_PI * i / (NE_HALFBAND_TAPS - 1)) +
+		    0.08 * cos(4.0 * M_PI * i / (NE_HALFBAND_TAPS - 1));
+		halfband[i] = w * (i == c ? 0.5 :
+				   sin(M_PI * (i - c) / 2.0) / (M_PI * (i - c)));
+		sum += halfband[i];
+	}
+	for (i = 0; i < NE_HALFBAND_TAPS; i++)
+		halfband[i] /= sum;
+}
+
+/* "--analysis-rate": the capture period that spans the fft size */
+static snd_pcm_uframes_t capture_period(const struct ne_capture_dev *d)
+{
+	uint64_t n = ((uint64_t)d->an->n_points * d->hwparams.rate +
+		      analysis_rate / 2) / analysis_rate;
+
+	return n > 1 ? n : 1;
+}
+
+/*
+ * The stream the engines see, once the source has settled its rate and
+ * period. For "--analysis-rate" at another rate than the capture's, the
+ * resampler goes by up/down in lowest terms, with more taps per phase
+ * the more it decimates so that the transition band stays as narrow.
+ * Matching rates go without; the period is then the fft size.
+ */
+static int resample_init(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	unsigned int x = analysis_rate, y = d->hwparams.rate, t;
+
+	an->rs_up = an->rs_taps = 0;
+	an->rs_pos = an->rs_phase = 0;
+	an->rate = d->hwparams.rate;
+	if (!analysis_rate || analysis_rate == d->hwparams.rate) {
+		an->n_points = an->fresh = an->fresh_max =
+		    d->hwparams.period_frames;
+		return 0;
+	}
+
+	while (y) {
+		t = x % y;
+		x = y;
+		y = t;
+	}
+	an->rs_up = analysis_rate / x;
+	an->rs_down = d->hwparams.rate / x;
+	an->rs_taps = (NE_RESAMPLE_TAPS * an->rs_down + an->rs_up - 1) /
+	    an->rs_up;
+	if (an->rs_taps < NE_RESAMPLE_TAPS)
+		an->rs_taps = NE_RESAMPLE_TAPS;
+	an->rs_taps = (an->rs_taps + 7) & ~7;
+	if (an->rs_up > NE_RESAMPLE_UP_MAX
+	    || an->rs_taps > NE_RESAMPLE_TAPS_MAX) {
+		prerr("can't resample %uHz to %uHz (%d/%d)\n",
+		      d->hwparams.rate, analysis_rate, an->rs_up, an->rs_down);
+		return -1;
+	}
+	an->rate = analysis_rate;
+	an->fresh = an->n_points;
+	an->fresh_max = d->hwparams.period_frames * an->rs_up / an->rs_down + 2;
+
+	if (!verbose)
+		printf("\n" "Resampler:" "\n%*uHz to %uHz (%d/%d)"
+		       "\n%*d taps per phase, %d-point fft" "\n", 28,
+		       d->hwparams.rate, analysis_rate, an->rs_up, an->rs_down,
+		       30, an->rs_taps, an->n_points);
+	return 0;
+}
+
+/*
+ * Blackman windowed-sinc low-pass at the resampler's "up" times the
+ * capture rate, cut off below the lower of the two nyquists, split into
+ * its "up" phases: tap j of phase p is prototype tap p + j * up, each
+ * phase reversed for the kernel's dot product. Unity gain at DC.
+ */
+static void resample_filter(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int i, up = an->rs_up, taps = an->rs_taps, len = up * taps;
+	double fc = NE_RESAMPLE_CUTOFF * 0.5 /
+	    (up > an->rs_down ? up : an->rs_down);
+	double x, w, h, sum = 0.0;
+
+	for (i = 0; i < len; i++) {
+		x = i - (len - 1) / 2.0;
+		w = 0.42 - 0.5 * cos(2.0 * M_PI * i / (len - 1)) +
+		    0.08 * cos(4.0 * M_PI * i / (len - 1));
+		h = w * (x == 0.0 ? 2.0 * fc : sin(2.0 * M_PI * fc * x) /
+			 (M_PI * x));
+		an->rs_coef[(i % up) * taps + taps - 1 - i / up] = h;
+		sum += h;
+	}
+	for (i = 0; i < len; i++)
+		an->rs_coef[i] *= up / sum;
+}
+
+/*
+ * Give each band to the octave its centre falls in, with the bins
+ * between the geometric midpoints to its neighbours (at least the one
+ * nearest its centre).
+ */
+static int octave_init(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int i, k;
+	const int M = NE_OCTAVE_POINTS;
+	float rate = an->rate, f, lo, hi, w;
+
+	/* the taps are shared, the first device computes them */
+	if (!halfband[NE_HALFBAND_TAPS / 2])
+		halfband_init();
+	for (i = 0; i < M; i++)
+		an->oct_window[i] = 0.5 - 0.5 * cos(2.0 * M_PI * i / M);
+
+	for (i = 0; i < an->nbands; i++) {
+		f = an->fband_hz[i];
+		for (k = 0; k < an->octaves - 1 && f < rate / (4 << k); k++)
+			;
+		w = rate / (1 << k) / M;
+		lo = i ? sqrtf(an->fband_hz[i - 1] * f) :
+		    f * sqrtf(f / an->fband_hz[an->nbands > 1 ? 1 : 0]);
+		hi = i < an->nbands - 1 ?
+		    sqrtf(f * an->fband_hz[i + 1]) : rate / 2;
+		an->band_octave[i] = k;
+		an->band_lo[i] = ceilf(lo / w);
+		an->band_hi[i] = floorf(hi / w);
+		if (an->band_hi[i] >= M / 2)
+			an->band_hi[i] = M / 2 - 1;
+		if (an->band_lo[i] > an->band_hi[i])
+			an->band_lo[i] = an->band_hi[i] = lrintf(f / w);
+		if (an->band_lo[i] < 1)
+			an->band_lo[i] = 1;
+		if (an->band_hi[i] < an->band_lo[i])
+			an->band_hi[i] = an->band_lo[i];
+	}
+
+#ifdef FFTW3
+	an->plan_oct =
+	    fftwf_plan_r2r_1d(M, an->scratch[0].oct_real,
+			      an->scratch[0].oct_cplx, FFTW_R2HC,
+			      FFTW_MEASURE);
+#else
+	an->plan_oct = rfftw_create_plan(M, FFTW_REAL_TO_COMPLEX,
+					 FFTW_ESTIMATE);
+#endif
+
+	if (!verbose)
+		printf("%*d octaves, %d-point fft each, %.2fHz finest bin\n",
+		       30, an->octaves, M, rate / (1 << (an->octaves - 1)) / M);
+	return 0;
+}
+
+/* "--zoom": decimation to at least twice the span, as far as it goes */
+static int zoom_decimation(const struct ne_capture_dev *d)
+{
+	int D = d->an->rate / (2.0f * zoom_span);
+
+	return D < 1 ? 1 : D > NE_ZOOM_DECIM_MAX ? NE_ZOOM_DECIM_MAX : D;
+}
+
+/*
+ * Zoom engine: Blackman windowed-sinc low-pass cut off at the decimated
+ * rate's nyquist, leaving the span clear of aliases; each band gets the
+ * bins between the midpoints to its neighbours (at least the one nearest
+ * its centre).
+ */
+static int zoom_init(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int i, M = zoom_points, D = an->zoom_decim, L = an->zoom_taps;
+	float res = (float)an->rate / D / M, f, lo, hi;
+	double x, w, h, sum = 0.0;
+
+	if (an->rate / (2.0f * zoom_span) < 2.0f ||
+	    an->rate / (2.0f * zoom_span) >= NE_ZOOM_DECIM_MAX + 1) {
+		prerr("zoom span %.2fHz out of range at %uHz (%.2f..%.0fHz)\n",
+		      zoom_span, an->rate,
+		      an->rate / (2.0f * NE_ZOOM_DECIM_MAX), an->rate / 4.0f);
+		return -1;
+	}
+	if (zoom_hz - zoom_span / 2 <= 0.0f ||
+	    zoom_hz + zoom_span / 2 >= an->rate / 2.0f) {
+		prerr("zoom span %.2f..%.2fHz is not within 0..%.0fHz\n",
+		      zoom_hz - zoom_span / 2, zoom_hz + zoom_span / 2,
+		      an->rate / 2.0f);
+		return -1;
+	}
+
+	for (i = 0; i < L; i++) {
+		x = i - (L - 1) / 2.0;
+		w = 0.42 - 0.5 * cos(2.0 * M_PI * i / (L - 1)) +
+		    0.08 * cos(4.0 * M_PI * i / (L - 1));
+		h = w * (x == 0.0 ? 1.0 / D : sin(M_PI * x / D) / (M_PI * x));
+		an->zoom_coef[L - 1 - i] = h;
+		sum += h;
+	}
+	for (i = 0; i < L; i++)
+		an->zoom_coef[i] /= sum;
+	an->zoom_fir = ne_resample_select(L);
+
+	for (i = 0; i < an->nbands; i++) {
+		f = an->fband_hz[i];
+		if (fabsf(f - zoom_hz) > zoom_span / 2) {
+			prerr("band %.2fHz is outside the zoom span\n", f);
+			return -1;
+		}
+		lo = i ? (an->fband_hz[i - 1] + f) / 2 : an->nbands > 1 ?
+		    f - (an->fband_hz[1] - f) / 2 : f;
+		hi = i < an->nbands - 1 ? (f + an->fband_hz[i + 1]) / 2 : i ?
+		    f + (f - an->fband_hz[i - 1]) / 2 : f;
+		an->band_lo[i] = ceilf((lo - zoom_hz) / res) + M / 2;
+		an->band_hi[i] = floorf((hi - zoom_hz) / res) + M / 2;
+		if (an->band_lo[i] > an->band_hi[i])
+			an->band_lo[i] = an->band_hi[i] =
+			    lrintf((f - zoom_hz) / res) + M / 2;
+		if (an->band_lo[i] < 0)
+			an->band_lo[i] = 0;
+		if (an->band_hi[i] > M - 1)
+			an->band_hi[i] = M - 1;
+	}
+
+#ifdef FFTW3
+	an->plan_zoom =
+	    fftwf_plan_dft_1d(M, (fftwf_complex *)an->scratch[0].zoom_z,
+			      (fftwf_complex *)an->scratch[0].zoom_zout,
+			      FFTW_FORWARD, FFTW_MEASURE);
+#else
+	an->plan_zoom = fftw_create_plan(M, FFTW_FORWARD, FFTW_ESTIMATE);
+#endif
+
+	if (!verbose)
+		printf("%*.2fHz +/- %.2fHz, decimated by %d (%d taps)"
+		       "\n%*d-point fft, %.4fHz bins" "\n", 28, zoom_hz,
+		       zoom_span / 2, D, L, 30, M, res);
+	return 0;
+}
+
+/*
+ * Pick the device's analysis engine, before its arena is carved for it.
+ * A Goertzel tone costs about n_points multiply-adds and a real fft about
+ * (n_points / 2) log2(n_points) butterflies of several flops each, so
+ * "auto" takes Goertzel for up to log2(n_points) tones. Full-spectrum
+ * outputs and "--features" always need the fft.
+ */
+static int engine_select(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int n_points = an->n_points;
+	int need_bins = spectrum_kind >= 0 || (waterfall_rows && waterfall_bins);
+
+	an->engine = engine;
+	if (an->engine == NE_ENGINE_AUTO)
+		an->engine = ntones && !need_bins && !features &&
+		    ntones <= (int)log2f(n_points) ?
+		    NE_ENGINE_GOERTZEL : NE_ENGINE_FFT;
+	if (an->engine == NE_ENGINE_GOERTZEL && (!ntones || need_bins)) {
+		prerr("the goertzel engine needs \"-T\" and no full spectrum "
+		      "output (\"-S\", \"--waterfall-bins\")\n");
+		return -1;
+	}
+	if (an->engine == NE_ENGINE_Q15 &&
+	    (need_bins || snd_pcm_format_physical_width(d->hwparams.format) != 16
+	     || n_points < 16 || n_points > 4096 || (n_points & (n_points - 1)))) {
+		prerr("the q15 engine needs S16 samples, a power of 2 period "
+		      "(16..4096) and no full spectrum output (\"-S\", "
+		      "\"--waterfall-bins\")\n");
+		return -1;
+	}
+	if (an->rs_up && an->engine == NE_ENGINE_Q15) {
+		prerr("the q15 engine can't take a resampled stream "
+		      "(\"--analysis-rate\")\n");
+		return -1;
+	}
+	if (gate && (an->engine == NE_ENGINE_Q15 ||
+		     an->engine == NE_ENGINE_OCTAVE ||
+		     an->engine == NE_ENGINE_ZOOM)) {
+		prerr("\"--gate\" needs the fft or goertzel engine\n");
+		return -1;
+	}
+	if (features && (an->engine != NE_ENGINE_FFT || !fanout_slots)) {
+		prerr("\"--features\" needs the fft engine and the fan-out "
+		      "ring (\"-F\")\n");
+		return -1;
+	}
+	if (an->engine == NE_ENGINE_OCTAVE && need_bins) {
+		prerr("the octave engine has no full spectrum output "
+		      "(\"-S\", \"--waterfall-bins\")\n");
+		return -1;
+	}
+	if (an->engine == NE_ENGINE_ZOOM && (need_bins || !zoom_span)) {
+		prerr("the zoom engine needs \"--zoom\" and publishes bands "
+		      "only, no \"-S\", \"--waterfall-bins\"\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* set up the engine engine_select() picked, in the device's arena */
+static int engine_init(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int i, n_points = an->n_points;
+	float hz_per_bin = (float)an->rate / (float)n_points;
+
+	if (gate) {
+		an->gate_close = n_points * pow(an->full_scale *
+						pow(10.0, gate_db / 20.0), 2.0);
+		an->gate_open = an->gate_close * pow(10.0, gate_hyst_db / 10.0);
+	}
+	if (an->rs_up)
+		resample_filter(d);
+
+	for (i = 0; i < ntones; i++) {
+		if (an->fband_hz[i] >= an->rate / 2.0f) {
+			prerr("tone %.1fHz is above Nyquist\n",
+			      an->fband_hz[i]);
+			return -1;
+		}
+		an->tone_bin[i] = lrintf(an->fband_hz[i] / hz_per_bin);
+		an->tone_coef[i] = 2.0 * cos(2.0 * M_PI * an->fband_hz[i] /
+					     an->rate);
+	}
+
+	if (!verbose)
+		printf("\n" "Analysis Engine:" "\n%*s (%d %s, %s window)" "\n",
+		       30, engine_name[an->engine],
+		       ntones ? ntones : an->nbands,
+		       ntones ? "tones" : "bands",
+		       an->engine == NE_ENGINE_OCTAVE ? "hann" :
+		       window_name[window_kind]);
+
+	if (an->engine == NE_ENGINE_GOERTZEL) {
+		an->analyze = do_goertzel;
+		return 0;
+	}
+	if (an->engine == NE_ENGINE_OCTAVE) {
+		an->analyze = do_octave;
+		return octave_init(d);
+	}
+	if (an->engine == NE_ENGINE_ZOOM) {
+		an->analyze = do_zoom;
+		return zoom_init(d);
+	}
+	if (an->engine == NE_ENGINE_Q15) {
+		an->analyze = do_q15;
+		q15_init(d);
+		return 0;
+	}
+	an->analyze = fft_pairs ? do_fft_pair : do_fft;
+	return fft_init(d);
+}
+
+/* spread "count" display bands logarithmically over the range
+ * of the default table, or evenly over the "--zoom" span */
+static float *fband_table(int count)
+{
+	int i;
+	float *hz, lo = ne_glprog_fband[0];
+	float hi = ne_glprog_fband[NE_GLPROG_FBANDS - 1];
+
+	hz = calloc(count, sizeof(float));
+	if (!hz) {
+		prerr("calloc(3) failed!\n");
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++)
+		hz[i] = zoom_span ? zoom_hz + zoom_span *
+		    ((i + 0.5f) / count - 0.5f) :
+		    lo * powf(hi / lo, (float)i / (float)(count - 1));
+	return hz;
+}
+
+/* the display bands every device starts out with; only an explicit
+ * "-B" (or "--zoom") replaces the default table */
+static int fband_init(int count)
+{
+	float *hz = ne_glprog_fband;
+	int given = count != 0;
+
+	if (!given)
+		count = NE_GLPROG_FBANDS;
+	if ((given || zoom_span) && !(hz = fband_table(count)))
+		return -1;
+	fband_hz = hz;
+	nbands = count;
+	return 0;
+}
+
+/* publish the band layout alongside the magnitudes for "ne_glprog" */
+static void fband_layout_publish(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	struct ne_glprog_fband_layout *layout =
+	    NE_GLPROG_FBAND_LAYOUT(d->ne_glprog_fband_data_map);
+	uint32_t gen = layout->gen | 1;
+
+	__atomic_store_n(&layout->gen, gen, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(layout->fband_hz, an->fband_hz, an->nbands * sizeof(float));
+	layout->nbands = an->nbands;
+	__atomic_store_n(&layout->gen, gen + 1, __ATOMIC_RELEASE);
+}
+
+static void *shm_init(const char *const filename, size_t filesize)
+{
+	int fd, ret = -1;
+	void *map = NULL;
+
+	fd = shm_open(filename, O_RDWR | O_CREAT, (mode_t) 0666);
+	if (fd < 0) {
+		prerr("%s\n", strerror(errno));
+		goto exit;
+	}
+
+	ret = ftruncate(fd, filesize);
+	if (ret < 0) {
+		prerr("%s\n", strerror(errno));
+		goto exit;
+	}
+
+	map = mmap(0, filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		prerr("%s\n", strerror(errno));
+		goto exit;
+	}
+
+	close(fd);
+	return map;
+exit:
+	return NULL;
+}
+
+/* per-device posix shm name: "base", or "base.ns" */
+static const char *dev_shm_name(struct ne_capture_dev *d, const char *base,
+				char *name, size_t size)
+{
+	if (!*d->ns)
+		return base;
+	snprintf(name, size, "%s.%s", base, d->ns);
+	return name;
+}
+
+static int waterfall_init(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	size_t filesize;
+	char name[NAME_MAX];
+	unsigned int cols;
+	int n_points = an->n_points;
+	struct ne_glprog_waterfall *wf;
+
+	cols = waterfall_bins ? (unsigned int)n_points / 2 + 1 :
+				(unsigned int)an->nbands;
+	filesize = NE_GLPROG_WATERFALL_SIZE(waterfall_rows, cols);
+	wf = shm_init(dev_shm_name(d, NE_GLPROG_WATERFALL_FILE, name,
+				   sizeof(name)), filesize);
+	if (!wf)
+		return -1;
+
+	/* rows are cleared; make old readers start over */
+	memset(wf, 0, filesize);
+	wf->version = NE_GLPROG_WATERFALL_VERSION;
+	wf->rows = waterfall_rows;
+	wf->cols = cols;
+	wf->bins = waterfall_bins;
+	wf->hz_per_col = waterfall_bins ? an->hz_per_bin : 0.0f;
+	wf->row_ms = 1000.0f * d->hwparams.period_frames / d->hwparams.rate;
+	an->waterfall_map = wf;
+
+	if (!verbose)
+		printf("\n" "Waterfall History:"
+		       "\n%*u rows x %u %s (%.1f s)\n",
+		       30, waterfall_rows, cols, waterfall_bins ? "bins" : "bands",
+		       waterfall_rows * wf->row_ms / 1000.0f);
+	return 0;
+}
+
+static int spectrum_init(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	size_t filesize;
+	char name[NAME_MAX];
+	unsigned int nvals, n_points = an->n_points;
+	struct ne_alsa_spectrum *sp;
+
+	nvals = spectrum_kind == NE_SPECTRUM_MAGN ? n_points / 2 + 1 : n_points;
+	filesize = NE_ALSA_SPECTRUM_SIZE(sizeof(fftw_real),
+					 an->analyze_channels,
+					 nvals);
+	sp = shm_init(dev_shm_name(d, NE_ALSA_SPECTRUM_FILE, name, sizeof(name)),
+		      filesize);
+	if (!sp)
+		return -1;
+
+	memset(sp, 0, filesize);
+	sp->version = NE_ALSA_SPECTRUM_VERSION;
+	sp->kind = spectrum_kind;
+	sp->value_size = sizeof(fftw_real);
+	sp->n_points = n_points;
+	sp->nvals = nvals;
+	sp->channels = an->analyze_channels;
+	sp->rate = an->rate;
+	an->spectrum_map = sp;
+	return 0;
+}
+
+static int fanout_init(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	size_t filesize, slot_size;
+	char name[NAME_MAX];
+	struct ne_alsa_fanout *fo;
+
+	slot_size = NE_FANOUT_SLOT_SIZE(an->analyze_channels, an->nbands,
+					features);
+	filesize = NE_ALSA_FANOUT_SIZE(fanout_slots, slot_size);
+	fo = shm_init(dev_shm_name(d, NE_ALSA_FANOUT_FILE, name, sizeof(name)),
+		      filesize);
+	if (!fo)
+		return -1;
+
+	/* readers of a previous run must re-attach */
+	memset(fo, 0, filesize);
+	fo->version = NE_ALSA_FANOUT_VERSION;
+	fo->slots = fanout_slots;
+	fo->slot_size = slot_size;
+	fo->channels = an->analyze_channels;
+	fo->nbands = an->nbands;
+	fo->features = features;
+	an->fanout_map = fo;
+	return 0;
+}
+
+static int set_hwparams(struct ne_capture_dev *d)
+{
+	ssize_t err = -1;
+	unsigned int channels = d->hwparams.channels;
+	unsigned int rrate, rate = d->hwparams.rate;
+	snd_pcm_format_t format = d->hwparams.format;
+	snd_pcm_uframes_t *period_size = &d->hwparams.period_frames;
+	snd_pcm_uframes_t buffer_size;
+
+	snd_pcm_hw_params_t *params;
+	snd_pcm_sw_params_t *swparams;
+	snd_pcm_hw_params_alloca(&params);
+
+	err = snd_pcm_hw_params_any(d->handle, params);
+	if (err < 0) {
+		prerr("%s\n", snd_strerror(err));
+		goto exit;
+	}
+
+	/* "--planar": channel planes straight from the driver, if it can */
+	d->planar = planar && snd_pcm_hw_params_set_access(d->handle, params,
+				SND_PCM_ACCESS_RW_NONINTERLEAVED) == 0;
+	if (planar && !d->planar)
+		prwarn("\"%s\": no non-interleaved access, "
+		       "interleaving\n", d->device);
+	if (!d->planar) {
+		err = snd_pcm_hw_params_set_access(d->handle, params,
+						   SND_PCM_ACCESS_RW_INTERLEAVED);
+		if (err < 0) {
+			prerr("%s\n", snd_strerror(err));
+			goto exit;
+		}
+	}
+
+	err = snd_pcm_hw_params_set_format(d->handle, params, format);
+	if (err < 0) {
+		prerr("%s\n", snd_strerror(err));
+		goto exit;
+	}
+	err = snd_pcm_hw_params_set_channels(d->handle, params, channels);
+	if (err < 0) {
+		prerr("%s\n", snd_strerror(err));
+		goto exit;
+	}
+
+	/* "--analysis-rate": the device's own rate nearest the one asked
+	 * for, no plugin resampling; the resampler brings it to ours */
+	if (analysis_rate) {
+		err = snd_pcm_hw_params_set_rate_resample(d->handle, params, 0);
+		if (err < 0) {
+			prerr("%s\n", snd_strerror(err));
+			goto exit;
+		}
+	}
+	rrate = rate;
+	err = snd_pcm_hw_params_set_rate_near(d->handle, params, &rrate, 0);
+	if (err < 0) {
+		prerr("Rate %iHz not available for playback: %s\n", rate,
+		      snd_strerror(err));
+		goto exit;
+	}
+	if (rrate != rate && !analysis_rate) {
+		prerr("Rate doesn't match (requested %iHz, got %iHz)\n", rate,
+		      rrate);
+		err = -EINVAL;
+		goto exit;
+	}
+	if (rrate != rate) {
+		d->hwparams.rate = rate = rrate;
+		*period_size = capture_period(d);
+	}
+
+	err = snd_pcm_hw_params_set_period_size_near(d->handle, params,
+						     period_size, 0);
+	if (err < 0) {
+		prerr("%s\n", snd_strerror(err));
+		goto exit;
+	}
+#if 0
+	/* we need not concern ourselves with calculating/specifying
+	 * a usable h/w ring buffer size since ALSA runtime
+	 * is quite capable of determining a suitable value for us.
+	 *
+	 * Otherwise, do something like...
+	 */
+	err = snd_pcm_hw_params_set_buffer_size_near(d->handle, params,
+						     &buffer_frames);
+	if (err < 0) {
+		prerr("%s\n", snd_strerror(err));
+		goto exit;
+	}
+#endif
+
+	err = snd_pcm_hw_params(d->handle, params);
+	if (err < 0) {
+		prerr("%s\n", snd_strerror(err));
+		goto exit;
+	}
+
+	/* hw pointer timestamps on CLOCK_MONOTONIC, for cross-device alignment */
+	snd_pcm_sw_params_alloca(&swparams);
+	if (snd_pcm_sw_params_current(d->handle, swparams) < 0 ||
+	    snd_pcm_sw_params_set_tstamp_mode(d->handle, swparams,
+					      SND_PCM_TSTAMP_ENABLE) < 0 ||
+	    snd_pcm_sw_params_set_tstamp_type(d->handle, swparams,
+					      SND_PCM_TSTAMP_TYPE_MONOTONIC) < 0 ||
+	    snd_pcm_sw_params(d->handle, swparams) < 0)
+		prwarn("\"%s\": no monotonic h/w timestamps\n", d->device);
+
+	snd_pcm_hw_params_get_buffer_size(params, &buffer_size);
+	if (*period_size == buffer_size) {
+		prerr("Can't use period equal to buffer size (%lu == %lu)",
+		      *(unsigned long *)period_size,
+		      (unsigned long)buffer_size);
+		err = -1;
+		goto exit;
+	}
+
+	if (!verbose)
+		printf("\n" "Accepted HWPARAMS (%s):\n%*iHz (%s)"
+		       "\n%*s (%s)"
+		       "\n%*i (%s)"
+		       "\n%*s (%s)"
+		       "\n%*lu (%s)"
+		       "\n%*lu (%s)"
+		       "\n", d->device,
+		       28, rate, "sampling rate",
+		       30, snd_pcm_format_name(format), "sample format",
+		       30, channels, "number of channels",
+		       30, d->planar ? "non-interleaved" : "interleaved",
+		       "access",
+		       30, buffer_size, "h/w ring buffer size in frames",
+		       30, *period_size, "period size in frames");
+
+	err = 0;
+exit:
+	return err;
+}
+
+/* octaves down to the one holding the lowest display band */
+static int octave_count(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	int k = 0;
+
+	while (k < NE_OCTAVES_MAX - 1 && (an->n_points >> k) > 1
+	       && an->fband_hz[0] < an->rate / (float)(4 << k))
+		k++;
+	return k + 1;
+}
+
+/* next NE_ARENA_ALIGN'ed chunk; only counts the bytes while sizing */
+static void *arena_alloc(struct ne_arena *a, size_t size)
+{
+	void *p = a->base ? a->base + a->used : NULL;
+
+	a->used += (size + NE_ARENA_ALIGN - 1) & ~(size_t)(NE_ARENA_ALIGN - 1);
+	return p;
+}
+
+/* one thread's engine scratch, only what the chosen engine uses */
+static void scratch_carve(struct ne_capture_dev *d, struct ne_scratch *s)
+{
+	struct ne_analysis *an = d->an;
+	struct ne_arena *a = &an->arena;
+	size_t n_points = an->n_points;
+	int i;
+
+	s->real = arena_alloc(a, n_points * sizeof(fftw_real));
+	s->cplx = arena_alloc(a, n_points * sizeof(fftw_real));
+	s->power = arena_alloc(a, n_points / 2 * sizeof(fftw_real));
+	if (fft_pairs) {
+		s->zin = arena_alloc(a, 2 * n_points * sizeof(fftw_real));
+		s->zout = arena_alloc(a, 2 * n_points * sizeof(fftw_real));
+		s->cplx2 = arena_alloc(a, n_points * sizeof(fftw_real));
+	}
+	s->tone_s1 = arena_alloc(a, ntones * sizeof(double));
+	s->tone_s2 = arena_alloc(a, ntones * sizeof(double));
+	if (an->engine == NE_ENGINE_Q15) {
+		s->q15_z = arena_alloc(a, n_points * sizeof(int16_t));
+		s->q15_power = arena_alloc(a, (n_points / 2 + 1) *
+					   sizeof(int64_t));
+	}
+	if (an->engine == NE_ENGINE_OCTAVE) {
+		s->oct_work = arena_alloc(a, (NE_HALFBAND_TAPS - 1 +
+					      an->fresh_max) * sizeof(float));
+		s->oct_buf[0] = arena_alloc(a, an->fresh_max * sizeof(float));
+		s->oct_buf[1] = arena_alloc(a, an->fresh_max * sizeof(float));
+		s->oct_real = arena_alloc(a, NE_OCTAVE_POINTS * sizeof(fftw_real));
+		s->oct_cplx = arena_alloc(a, NE_OCTAVE_POINTS * sizeof(fftw_real));
+	}
+	if (an->engine == NE_ENGINE_ZOOM) {
+		size_t len = an->zoom_taps - 1;
+
+		for (i = 0; i < 2; i++) {
+			s->zoom_work[i] = arena_alloc(a, (len + an->fresh_max) *
+						      sizeof(float));
+			s->zoom_dec[i] = arena_alloc(a, (an->fresh_max /
+							 an->zoom_decim + 1) *
+						     sizeof(float));
+		}
+		s->zoom_z = arena_alloc(a, 2 * zoom_points * sizeof(fftw_real));
+		s->zoom_zout = arena_alloc(a, 2 * zoom_points *
+					   sizeof(fftw_real));
+	}
+}
+
+/* lay out the device's buffers in the order the pipeline walks them */
+static void arena_carve(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	struct ne_arena *a = &an->arena;
+	int i;
+	size_t period = d->hwparams.period_frames, n_points = an->n_points;
+	size_t nch = an->analyze_channels, len = an->rs_taps - 1;
+	size_t chunk_bytes = period * d->hwparams.channels *
+	    snd_pcm_format_physical_width(d->hwparams.format) / 8;
+
+	a->used = 0;
+	if (an->engine == NE_ENGINE_OCTAVE)
+		an->octaves = octave_count(d);
+	if (an->engine == NE_ENGINE_ZOOM) {
+		an->zoom_decim = zoom_decimation(d);
+		an->zoom_taps = NE_ZOOM_TAPS * an->zoom_decim;
+	}
+	/* capture, deinterleave, resample */
+	an->batchbuf = arena_alloc(a, catch_up * chunk_bytes);
+	an->audiobuf = an->batchbuf;
+	if (an->rs_up) {
+		an->rs_in = arena_alloc(a, period * d->hwparams.channels *
+					sizeof(float));
+		an->rs_coef = arena_alloc(a, an->rs_up * an->rs_taps *
+					  sizeof(float));
+		an->rs_work = arena_alloc(a, (len + period) * sizeof(float));
+		an->rs_delay = arena_alloc(a, nch * len * sizeof(float));
+		an->rs_out = arena_alloc(a, nch * an->fresh_max *
+					 sizeof(float));
+		an->chnldata = arena_alloc(a, nch * n_points * sizeof(float));
+	} else
+		an->chnldata = arena_alloc(a, period * d->hwparams.channels *
+					   sizeof(float));
+	/* per thread scratch, see struct ne_scratch */
+	for (i = 0; i <= dsp_threads; i++)
+		scratch_carve(d, &an->scratch[i]);
+	/* windows, one per tuning */
+	for (i = 0; i < 2; i++) {
+		struct ne_tuning *tn = &an->tuning[i];
+
+		tn->window = arena_alloc(a, n_points * sizeof(double));
+		if (an->engine == NE_ENGINE_Q15)
+			tn->q15_window = arena_alloc(a, n_points *
+						     sizeof(int16_t));
+		if (an->engine == NE_ENGINE_ZOOM)
+			tn->zoom_window = arena_alloc(a, zoom_points *
+						      sizeof(double));
+	}
+	an->tune = &an->tuning[0];
+	an->retune = NULL;
+	/* tones */
+	an->tone_bin = arena_alloc(a, ntones * sizeof(int));
+	an->tone_coef = arena_alloc(a, ntones * sizeof(double));
+	/* q15 engine */
+	if (an->engine == NE_ENGINE_Q15) {
+		an->q15_in = arena_alloc(a, nch * n_points * sizeof(int16_t));
+		an->q15_tw = arena_alloc(a, n_points * sizeof(int16_t));
+		an->q15_bitrev = arena_alloc(a, n_points / 2 *
+					     sizeof(uint16_t));
+	}
+	/* octave engine */
+	if (an->engine == NE_ENGINE_OCTAVE) {
+		size_t octs = nch * an->octaves;
+
+		an->oct_window = arena_alloc(a, NE_OCTAVE_POINTS *
+					     sizeof(double));
+		an->oct_delay = arena_alloc(a, octs * (NE_HALFBAND_TAPS - 1) *
+					    sizeof(float));
+		an->oct_hist = arena_alloc(a, octs * NE_OCTAVE_POINTS *
+					   sizeof(float));
+		an->oct_fresh = arena_alloc(a, octs * sizeof(int));
+		an->oct_phase = arena_alloc(a, octs * sizeof(int));
+		an->band_octave = arena_alloc(a, an->nbands * sizeof(int));
+		an->band_lo = arena_alloc(a, an->nbands * sizeof(int));
+		an->band_hi = arena_alloc(a, an->nbands * sizeof(int));
+	}
+	/* zoom engine */
+	if (an->engine == NE_ENGINE_ZOOM) {
+		size_t len = an->zoom_taps - 1;
+
+		an->zoom_coef = arena_alloc(a, an->zoom_taps * sizeof(float));
+		an->zoom_phase = arena_alloc(a, nch * sizeof(double));
+		an->zoom_delay = arena_alloc(a, nch * 2 * len * sizeof(float));
+		an->zoom_pos = arena_alloc(a, nch * sizeof(int));
+		an->zoom_hist = arena_alloc(a, nch * 2 * zoom_points *
+					    sizeof(float));
+		an->band_lo = arena_alloc(a, an->nbands * sizeof(int));
+		an->band_hi = arena_alloc(a, an->nbands * sizeof(int));
+	}
+	/* band grouping, ballistics */
+	an->bin_band = arena_alloc(a, n_points * sizeof(int));
+	an->band_level = arena_alloc(a, nch * an->nbands * sizeof(float));
+	an->band_out = arena_alloc(a, nch * an->nbands * sizeof(float));
+	an->band_hold = arena_alloc(a, nch * an->nbands * sizeof(float));
+	if (gate) {
+		an->ch_peak = arena_alloc(a, nch * sizeof(float));
+		an->ch_sumsq = arena_alloc(a, nch * sizeof(double));
+		an->gated = arena_alloc(a, nch);
+	}
+	if (features) {
+		an->feat = arena_alloc(a, nch * sizeof(*an->feat));
+		an->feat_acc = arena_alloc(a, nch * sizeof(*an->feat_acc));
+		an->feat_power = arena_alloc(a, nch * n_points / 2 *
+					     sizeof(float));
+		an->flux_mean = arena_alloc(a, nch * sizeof(float));
+	}
+	if (catch_up > 1 || publish_rate) {
+		an->band_fold = arena_alloc(a, nch * an->nbands *
+					    sizeof(float));
+	}
+}
+
+static int arena_init(struct ne_capture_dev *d)
+{
+	struct ne_arena *a = &d->an->arena;
+	unsigned long fmt_phys_width_bits =
+	    snd_pcm_format_physical_width(d->hwparams.format);
+	unsigned long fmt_phys_width_bits_per_frame =
+	    fmt_phys_width_bits * d->hwparams.channels;
+	size_t page = sysconf(_SC_PAGE_SIZE);
+	void *map = MAP_FAILED;
+
+	/* sizing pass */
+	a->base = NULL;
+	arena_carve(d);
+
+	/* prefaulted and zeroed; mlockall() keeps it resident later on */
+	if (hugepages) {
+		a->size = (a->used + NE_HUGEPAGE_SIZE - 1) &
+		    ~(size_t)(NE_HUGEPAGE_SIZE - 1);
+		map = mmap(NULL, a->size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE |
+			   MAP_HUGETLB, -1, 0);
+		if (map == MAP_FAILED)
+			prwarn("no huge pages (%s), using normal pages\n",
+			       strerror(errno));
+	}
+	if (map == MAP_FAILED) {
+		a->size = (a->used + page - 1) & ~(page - 1);
+		map = mmap(NULL, a->size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	}
+	if (map == MAP_FAILED) {
+		prerr("mmap(2): %s\n", strerror(errno));
+		a->size = 0;
+		return -1;
+	}
+	a->base = map;
+	arena_carve(d);
+
+	if (!verbose)
+		printf("\n" "PCM Data Transfer Stats:"
+		       "\n%*lu bits/sample, %lu bits/frame"
+		       "\n%*lu period size in bytes (pcm data transfer size)"
+		       "\n%*zu buffer arena in bytes (%zu used)"
+		       "\n", 30, fmt_phys_width_bits,
+		       fmt_phys_width_bits_per_frame, 30,
+		       d->hwparams.period_frames * fmt_phys_width_bits_per_frame / 8,
+		       30, a->size, a->used);
+	return 0;
+}
+
+static const char *prog;
+static void usage( )
+{
+	fprintf(stderr, "\n" "Usage: %s [OPTIONS]\n"
+			   "\n\n"
+				 "OPTIONS:\n"
+	       "-h,--help         This menu\n"
+	       "-D,--device       Virtual PCM device, e.g. \"plguhw:0,0\", \"default\", etc\n"
+	       "                  or another source: \"file:PATH\", \"stdin\" (raw pcm as\n"
+	       "                  \"-o\", \"-c\", \"-r\"), \"replay:LOG\" or \"synth:[KIND]\n"
+	       "                  [,KEY=VAL..]\": KIND tones, sweep, noise or impulse,\n"
+	       "                  KEY f=HZ[+HZ..], level=DBFS, noise=DBFS, secs=S,\n"
+	       "                  jitter=MS or xrun=P; \"alsa:NAME\" forces ALSA\n"
+	       "                  Repeat for parallel capture; \"name@ns\" appends \".ns\"\n"
+	       "                  to the device's shm files (default: its index)\n"
+	       "-L,--link         Link all devices for a synchronized start\n"
+	       "-r,--rate         Sample rate in Hz, e.g. 44100\n"
+	       "-c,--channels     Channel count, e.g. 2 for stereo\n"
+	       "-b,--buffer-size  H/W Ring buffer size in frames (not used)\n"
+	       "-p,--period-size  Period size in frames, e.g. 1024\n"
+	       "   --analysis-rate Capture at the device's own rate (no ALSA\n"
+	       "                  resampling) and resample the analyzed channels\n"
+	       "                  to this one in Hz, e.g. 48000; \"-p\" is then\n"
+	       "                  the fft size at it. Not with the q15 engine\n"
+	       "-o,--format       Sample format, e.g. \"S16_LE\", \"U32_BE\", etc\n"
+	       "   --planar       Capture each channel into its own plane (ALSA\n"
+	       "                  non-interleaved access), if the device can\n"
+	       "   --catch-up     Most periods read at once when the capture falls\n"
+	       "                  behind, only the newest published and the rest\n"
+	       "                  taken down to their bands (1..%d), default %d;\n"
+	       "                  1 reads one at a time\n"
+	       "-B,--bands        Number of log-spaced display bands (2..%d); without it\n"
+	       "                  the built-in %d-band table\n"
+	       "-T,--tones        Comma separated tone frequencies in Hz, one band each,\n"
+	       "                  e.g. \"50,100,150\" for mains hum; not with \"-B\"\n"
+	       "   --fft-pairs    FFT analyzed channels two at a time in one complex fft\n"
+	       "   --engine       Analysis engine: \"fft\", \"goertzel\" (\"-T\" only),\n"
+	       "                  \"octave\" (decimated, finer low bands), \"q15\" (fixed\n"
+	       "                  point, S16 only), \"zoom\" (see \"--zoom\") or \"auto\"\n"
+	       "                  (default: goertzel for few enough tones, else fft)\n"
+	       "   --zoom         CENTER,SPAN[,POINTS] in Hz: zoom engine, resolving\n"
+	       "                  CENTER +/- SPAN/2 alone in a POINTS-point fft\n"
+	       "                  (default %d) of the stream mixed down and\n"
+	       "                  decimated to about twice SPAN (by up to %d), e.g.\n"
+	       "                  \"50,100,8192\" for 0.024Hz bins at 48kHz; \"-B\"\n"
+	       "                  bands evenly over SPAN\n"
+	       "   --bench        Time fft vs q15 over N synthetic periods and exit\n"
+	       "   --dsp-threads  Extra threads per device sharing the analysis of\n"
+	       "                  each period (0..%d), default 0; see \"-R dsp\"\n"
+	       "   --record       Log raw periods with their timestamps, avail and\n"
+	       "                  xruns to a file (\".ns\" appended per device)\n"
+	       "   --record-periods Periods the log keeps (newest), default %d\n"
+	       "   --replay       Analyze a \"--record\" log instead of capturing,\n"
+	       "                  same as \"-D replay:LOG\"\n"
+	       "   --fast         Feed file, stdin, synth and replay sources as fast\n"
+	       "                  as possible, not at the stream's pace\n"
+				 "-f,--dumpfile     Raw capture data dump file (posix shm)\n"
+	       "-W,--waterfall    Spectrogram history depth in periods (posix shm)\n"
+	       "   --waterfall-bins Keep FFT bins rather than display bands in \"-W\"\n"
+	       "   --attack       Display band rise time in ms, default 0 (instant)\n"
+	       "   --release      Display band fall time in ms, default 300\n"
+	       "   --hold         Display band peak hold in ms, default 0\n"
+	       "   --window       FFT window: \"rect\" (default), \"hann\", \"hamming\"\n"
+	       "                  or \"blackman\", at unit coherent gain; the octave\n"
+	       "                  engine keeps its own hann\n"
+	       "   --control      FIFO (created if missing) of \"KEY VALUE\" lines that\n"
+	       "                  reconfigure the analysis without a restart: bands N,\n"
+	       "                  analyze N, window NAME, attack|release|hold MS or\n"
+	       "                  period N (reopens ALSA devices; not with \"-L\",\n"
+	       "                  \"--record\" or a replay; the fft size with\n"
+	       "                  \"--analysis-rate\")\n"
+	       "   --publish-rate Display frames per second, e.g. 60, default 0 (every\n"
+	       "                  period); the periods between frames are aggregated\n"
+	       "   --publish-mode How: \"max\" (default, keeps transients) or \"mean\"\n"
+	       "   --features     Add per channel peak, rms, spectral centroid,\n"
+	       "                  rolloff, flux and onset to \"-F\" frames (fft engine\n"
+	       "                  only)\n"
+	       "   --gate         DBFS[,HYST]: skip the analysis of channels whose\n"
+	       "                  rms falls below DBFS, e.g. -60, until it is back\n"
+	       "                  HYST dB above (default %.0f); fft, goertzel only\n"
+	       "-a,--analyze      Number of channels to analyze, default 1\n"
+	       "-S,--spectrum     Publish the full spectrum (posix shm) as \"magn\"\n"
+	       "                  or \"complex\" (raw fft halfcomplex output)\n"
+	       "-F,--fanout       Multi-reader frame ring depth in periods (posix shm)\n"
+	       "-R,--rt           Realtime setup of a thread role, repeatable:\n"
+	       "                  ROLE:[CPUS]:[POLICY]:[PRIO]:[PREFAULT], e.g.\n"
+	       "                  \"capture:2-3:fifo:60:64k\", empty fields keep\n"
+	       "                  the defaults. ROLE is capture (which publishes\n"
+	       "                  too), dsp or main (housekeeping), POLICY fifo, rr\n"
+	       "                  or other, PREFAULT is stack bytes\n"
+	       "-H,--hugepages    Back each device's buffers with huge pages\n"
+	       "-v,--verbose      Display PCM S/W conversions\n" "\n", prog,
+	       NE_CATCH_UP_MAX, NE_CATCH_UP_DEFAULT, NE_GLPROG_FBANDS_MAX,
+	       NE_GLPROG_FBANDS, NE_ZOOM_POINTS, NE_ZOOM_DECIM_MAX,
+	       NE_DSP_THREADS_MAX,
+	       NE_RECORD_PERIODS_DEFAULT, NE_GATE_HYST_DEFAULT);
+
+	fprintf(stderr, "Recognized sample formats are: "
+	"S16_LE S16_BE S24_LE S24_BE S32_LE S32_BE");
+	fprintf(stderr, "\n\n");
+	exit(EXIT_SUCCESS);
+}
+
+static void bad_option(const char *option)
+{
+	fprintf(stderr, "\n\tBad option \"%s\"\n", option);
+	usage();
+}
+
+static int set_prio(int policy, int prio)
+{
+	struct sched_param param;
+	int err;
+
+	param.sched_priority = prio;
+	err = pthread_setschedparam(pthread_self(), policy, &param);
+	if (err) {
+		prwarn("%s\n", strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+static int set_affinity(const cpu_set_t *set)
+{
+	int err;
+
+	err = pthread_setaffinity_np(pthread_self(), sizeof(*set), set);
+	if (err) {
+		prwarn("%s\n", strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+/* touch "size" bytes of stack now rather than page-faulting in the loop */
+static void stack_prefault(size_t size)
+{
+	unsigned char *dummy = alloca(size);
+
+	memset(dummy, 0, size);
+	__asm__ __volatile__("" : : "r"(dummy) : "memory");
+}
+
+/* "0-3,6" cpu list, as in sysfs and taskset(1); returns the cpu count */
+static int parse_cpulist(const char *s, cpu_set_t *set)
+{
+	unsigned long lo, hi;
+	char *eptr;
+	int n = 0;
+
+	CPU_ZERO(set);
+	while (*s && *s != '\n') {
+		lo = hi = strtoul(s, &eptr, 10);
+		if (eptr == s)
+			return -1;
+		if (*eptr == '-') {
+			s = eptr + 1;
+			hi = strtoul(s, &eptr, 10);
+			if (eptr == s || hi < lo)
+				return -1;
+		}
+		if (hi >= CPU_SETSIZE)
+			return -1;
+		for (; lo <= hi; lo++, n++)
+			CPU_SET(lo, set);
+		s = eptr;
+		if (*s == ',')
+			s++;
+		else if (*s && *s != '\n')
+			return -1;
+	}
+	return n;
+}
+
+/* the n-th cpu (wrapping around) of a role's set */
+static int role_cpu(const struct ne_rt_role *role, int n)
+{
+	int cpu;
+
+	n %= role->ncpus;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &role->cpus) && !n--)
+			break;
+	return cpu;
+}
+
+/* "-T" list: the tones become the display bands */
+static int parse_tones(const char *arg)
+{
+	float *hz;
+	char *eptr;
+	int n = 0;
+
+	if (!(hz = calloc(NE_GLPROG_FBANDS_MAX, sizeof(float))))
+		return -1;
+	do {
+		if (n == NE_GLPROG_FBANDS_MAX)
+			goto fail;
+		hz[n] = strtof(arg, &eptr);
+		if (eptr == arg || hz[n] <= 0.0f || (*eptr && *eptr != ','))
+			goto fail;
+		n++;
+		arg = eptr + 1;
+	} while (*eptr);
+
+	fband_hz = hz;
+	nbands = ntones = n;
+	return 0;
+fail:
+	free(hz);
+	return -1;
+}
+
+/* ROLE:[CPUS]:[POLICY]:[PRIO]:[PREFAULT], see usage() */
+static int parse_rt_role(char *arg)
+{
+	struct ne_rt_role *role = NULL, r;
+	char *field[5] = { NULL }, *eptr;
+	unsigned long val;
+	int i, n = 0;
+
+	for (field[n++] = arg; n < 5 && (arg = strchr(arg, ':')); n++) {
+		*arg++ = '\0';
+		field[n] = arg;
+	}
+	for (i = 0; i < NE_ROLES; i++)
+		if (!strcmp(field[0], rt_roles[i].name))
+			role = &rt_roles[i];
+	if (!role)
+		return -1;
+	r = *role;
+
+	if (field[1] && *field[1] &&
+	    (r.ncpus = parse_cpulist(field[1], &r.cpus)) <= 0)
+		return -1;
+	if (field[2] && *field[2]) {
+		if (!strcmp(field[2], "fifo"))
+			r.policy = SCHED_FIFO;
+		else if (!strcmp(field[2], "rr"))
+			r.policy = SCHED_RR;
+		else if (!strcmp(field[2], "other"))
+			r.policy = SCHED_OTHER;
+		else
+			return -1;
+		if (r.policy == SCHED_OTHER)
+			r.prio = 0;
+	}
+	if (field[3] && *field[3]) {
+		r.prio = strtol(field[3], &eptr, 0);
+		if (*eptr != '\0')
+			return -1;
+	}
+	if (r.prio < sched_get_priority_min(r.policy) ||
+	    r.prio > sched_get_priority_max(r.policy))
+		return -1;
+	if (field[4] && *field[4]) {
+		val = strtoul(field[4], &eptr, 0);
+		if (*eptr == 'k' || *eptr == 'K')
+			val *= 1024, eptr++;
+		if (*eptr != '\0' || val > NE_PREFAULT_MAX)
+			return -1;
+		r.prefault = val;
+	}
+	*role = r;
+	return 0;
+}
+
+/* process-wide part: keep all memory resident */
+static int go_rt(void)
+{
+	int err = -1;
+
+	/* prevent being paged out during rt execution */
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		prwarn("%s\n", strerror(errno));
+		goto exit;
+	}
+
+	err = 0;
+exit:
+	return err;
+}
+
+/*
+ * per thread part, run by the thread itself: "cpu" pins it to a single
+ * core, -1 lets it run anywhere in the role's set.
+ */
+static int go_rt_thread(int role_id, int cpu)
+{
+	const struct ne_rt_role *role = &rt_roles[role_id];
+	cpu_set_t set;
+	int err = 0;
+
+	if (cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (set_affinity(&set))
+			err = -1;
+	} else if (role->ncpus && set_affinity(&role->cpus))
+		err = -1;
+
+	/* SCHED_FIFO/RR: 1 for min prio; 99 for max prio */
+	if (set_prio(role->policy, role->prio))
+		err = -1;
+
+	/* prefault thread stack */
+	stack_prefault(role->prefault);
+
+	return err;
+}
+
+/* is "cpu" in the cpu list held by sysfs/procfs file "path"? */
+static int cpu_listed(const char *path, int cpu)
+{
+	char buf[256];
+	cpu_set_t set;
+	FILE *fp;
+	int ret = 0;
+
+	if (!(fp = fopen(path, "r")))
+		return -1;
+	if (fgets(buf, sizeof(buf), fp) && parse_cpulist(buf, &set) > 0)
+		ret = CPU_ISSET(cpu, &set);
+	fclose(fp);
+	return ret;
+}
+
+/*
+ * Warn about a capture core that the scheduler may still balance other
+ * tasks onto ("isolcpus="), or that also takes the sound card's IRQ.
+ */
+static void rt_check(void)
+{
+	char line[512], path[64], card[16];
+	snd_pcm_info_t *info;
+	FILE *fp;
+	int i, irq, n;
+
+	snd_pcm_info_alloca(&info);
+	for (i = 0; i < ndevs; i++) {
+		if (!cpu_listed("/sys/devices/system/cpu/isolated", devs[i].cpu))
+			prwarn("\"%s\": cpu %d is not isolated\n",
+			       devs[i].device, devs[i].cpu);
+
+		if (!devs[i].handle || snd_pcm_info(devs[i].handle, info) < 0 ||
+		    (n = snd_pcm_info_get_card(info)) < 0)
+			continue;
+		snprintf(card, sizeof(card), ":card%d", n);
+		if (!(fp = fopen("/proc/interrupts", "r")))
+			continue;
+		while (fgets(line, sizeof(line), fp)) {
+			if (!strstr(line, "snd") || !strstr(line, card) ||
+			    sscanf(line, " %d:", &irq) != 1)
+				continue;
+			snprintf(path, sizeof(path),
+				 "/proc/irq/%d/effective_affinity_list", irq);
+			if ((n = cpu_listed(path, devs[i].cpu)) < 0) {
+				snprintf(path, sizeof(path),
+					 "/proc/irq/%d/smp_affinity_list", irq);
+				n = cpu_listed(path, devs[i].cpu);
+			}
+			if (n > 0)
+				prwarn("\"%s\": cpu %d also takes the sound "
+				       "card's irq %d\n", devs[i].device,
+				       devs[i].cpu, irq);
+		}
+		fclose(fp);
+	}
+}
+
+/* long-only options */
+enum {
+	OPT_WATERFALL_BINS = 0x100,
+	OPT_ATTACK,
+	OPT_RELEASE,
+	OPT_HOLD,
+	OPT_ENGINE,
+	OPT_FFT_PAIRS,
+	OPT_BENCH,
+	OPT_DSP_THREADS,
+	OPT_RECORD,
+	OPT_RECORD_PERIODS,
+	OPT_REPLAY,
+	OPT_FAST,
+	OPT_PLANAR,
+	OPT_CATCH_UP,
+	OPT_PUBLISH_RATE,
+	OPT_PUBLISH_MODE,
+	OPT_FEATURES,
+	OPT_GATE,
+	OPT_WINDOW,
+	OPT_CONTROL,
+	OPT_ANALYSIS_RATE,
+	OPT_ZOOM,
+};
+
+static void do_getopt_long(int argc, char *const *argv)
+{
+	snd_pcm_format_t format;
+	int i;
+	struct option long_option[] = {
+		{"help", 0, NULL, 'h'},
+		{"device", 1, NULL, 'D'},
+		{"link", 0, NULL, 'L'},
+		{"rate", 1, NULL, 'r'},
+		{"channels", 1, NULL, 'c'},
+		{"buffer-size", 1, NULL, 'b'},
+		{"period-size", 1, NULL, 'p'},
+		{"format", 1, NULL, 'o'},
+		{"verbose", 0, NULL, 'v'},
+		{"dumpfile", 1, NULL, 'f'},
+		{"bands", 1, NULL, 'B'},
+		{"waterfall", 1, NULL, 'W'},
+		{"waterfall-bins", 0, NULL, OPT_WATERFALL_BINS},
+		{"attack", 1, NULL, OPT_ATTACK},
+		{"release", 1, NULL, OPT_RELEASE},
+		{"hold", 1, NULL, OPT_HOLD},
+		{"tones", 1, NULL, 'T'},
+		{"engine", 1, NULL, OPT_ENGINE},
+		{"fft-pairs", 0, NULL, OPT_FFT_PAIRS},
+		{"bench", 1, NULL, OPT_BENCH},
+		{"dsp-threads", 1, NULL, OPT_DSP_THREADS},
+		{"record", 1, NULL, OPT_RECORD},
+		{"record-periods", 1, NULL, OPT_RECORD_PERIODS},
+		{"replay", 1, NULL, OPT_REPLAY},
+		{"fast", 0, NULL, OPT_FAST},
+		{"planar", 0, NULL, OPT_PLANAR},
+		{"catch-up", 1, NULL, OPT_CATCH_UP},
+		{"publish-rate", 1, NULL, OPT_PUBLISH_RATE},
+		{"publish-mode", 1, NULL, OPT_PUBLISH_MODE},
+		{"features", 0, NULL, OPT_FEATURES},
+		{"gate", 1, NULL, OPT_GATE},
+		{"window", 1, NULL, OPT_WINDOW},
+		{"control", 1, NULL, OPT_CONTROL},
+		{"analysis-rate", 1, NULL, OPT_ANALYSIS_RATE},
+		{"zoom", 1, NULL, OPT_ZOOM},
+		{"analyze", 1, NULL, 'a'},
+		{"spectrum", 1, NULL, 'S'},
+		{"fanout", 1, NULL, 'F'},
+		{"rt", 1, NULL, 'R'},
+		{"hugepages", 0, NULL, 'H'},
+		{NULL, 0, NULL, 0},
+	};
+	char *eptr;
+
+	for (;;) {
+		int c;
+		if ((c =
+		     getopt_long(argc, argv, "hD:Lr:c:b:p:o:f:vB:W:a:S:F:R:HT:",
+				 long_option, NULL)) < 0)
+			break;
+		switch (c) {
+		case 'D':
+			if (ndevs == NE_MAX_DEVICES)
+				bad_option("Too many devices");
+			if (!(devs[ndevs].device = strdup(optarg))) {
+				prerr("strdup(3)\n");
+				exit(EXIT_FAILURE);
+			}
+			/* "name@namespace" */
+			if ((eptr = strrchr(devs[ndevs].device, '@'))) {
+				*eptr++ = '\0';
+				devs[ndevs].ns = eptr;
+			}
+			ndevs++;
+			break;
+		case 'L':
+			link_devices = 1;
+			break;
+		case 'r':
+			hwparams.rate = strtoul(optarg, &eptr, 0);
+			if (*eptr != '\0')
+				bad_option("Sample Rate");
+			break;
+		case 'c':
+			hwparams.channels = strtoul(optarg, &eptr, 0);
+			if (*eptr != '\0')
+				bad_option("Channel Count");
+			break;
+		case 'b':
+			hwparams.buffer_frames = strtoul(optarg, &eptr, 0);
+			if (*eptr != '\0')
+				bad_option("H/W Buffer Size");
+			break;
+		case 'p':
+			hwparams.period_frames = strtoul(optarg, &eptr, 0);
+			if (*eptr != '\0')
+				bad_option("Period Size");
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'B':
+			/* the tones are the bands */
+			if (ntones)
+				bad_option("Display Bands (not with -T)");
+			nbands = strtoul(optarg, &eptr, 0);
+			if (*eptr != '\0' || nbands < 2
+			    || nbands > NE_GLPROG_FBANDS_MAX)
+				bad_option("Display Bands");
+			break;
+		case 'T':
+			if (nbands != ntones)
+				bad_option("Tones (not with -B)");
+			if (parse_tones(optarg))
+				bad_option("Tones");
+			break;
+		case OPT_BENCH:
+			bench_periods = strtoul(optarg, &eptr, 0);
+			if (*eptr != '\0' || bench_periods < 1)
+				bad_option("Benchmark Periods");
+			break;
+		case OPT_FFT_PAIRS:
+			fft_pairs = 1;
+			break;
+		case OPT_DSP_THREADS:
+			dsp_threads = strtoul(optarg, &eptr, 0);
+			if (*eptr != '\0' || dsp_threads < 0
+			    || dsp_threads > NE_DSP_THREADS_MAX)
+				bad_option("DSP Threads");
+			break;
+		case OPT_RECORD:
+			record_file = optarg;
+			break;
+		case OPT_RECORD_PERIODS:
+			record_periods = strtoul(optarg, &eptr, 0);
+			if (*eptr != '\0' || record_periods < 1)
+				bad_option("Record Periods");
+			break;
+		case OPT_REPLAY:
+			replay_file = optarg;
+			break;
+		case OPT_FAST:
+			source_fast = 1;
+			break;
+		case OPT_PLANAR:
+			planar = 1;
+			break;
+		case OPT_CATCH_UP:
+			catch_up = strtoul(optarg, &eptr, 0);
+			if (*eptr != '\0' || catch_up < 1
+			    || catch_up > NE_CATCH_UP_MAX)
+				bad_option("Catch Up");
+			break;
+		case OPT_PUBLISH_RATE:
+			publish_rate = strtof(optarg, &eptr);
+			if (*eptr != '\0' || publish_rate < 0.0f)
+				bad_option("Publish Rate");
+			break;
+		case OPT_PUBLISH_MODE:
+			if (!strcmp(optarg, "max"))
+				publish_mode = NE_PUBLISH_MAX;
+			else if (!strcmp(optarg, "mean"))
+				publish_mode = NE_PUBLISH_MEAN;
+			else
+				bad_option("Publish Mode");
+			break;
+		case OPT_FEATURES:
+			features = 1;
+			break;
+		case OPT_GATE:
+			gate = 1;
+			gate_db = strtof(optarg, &eptr);
+			if (*eptr == ',')
+				gate_hyst_db = strtof(eptr + 1, &eptr);
+			if (*eptr != '\0' || gate_db >= 0.0f || gate_hyst_db < 0.0f)
+				bad_option("Gate");
+			break;
+		case OPT_WINDOW:
+			for (i = NE_WINDOW_BLACKMAN; i > 0; i--)
+				if (!strcmp(optarg, window_name[i]))
+					break;
+			if (strcmp(optarg, window_name[i]))
+				bad_option("Window");
+			window_kind = i;
+			break;
+		case OPT_CONTROL:
+			control_file = optarg;
+			break;
+		case OPT_ZOOM:
+			engine = NE_ENGINE_ZOOM;
+			zoom_hz = strtof(optarg, &eptr);
+			if (*eptr == ',')
+				zoom_span = strtof(eptr + 1, &eptr);
+			if (*eptr == ',')
+				zoom_points = strtoul(eptr + 1, &eptr, 0);
+			if (*eptr != '\0' || zoom_hz <= 0.0f
+			    || zoom_span <= 0.0f || zoom_points < 16
+			    || zoom_points > 65536)
+				bad_option("Zoom");
+			break;
+		case OPT_ANALYSIS_RATE:
+			analysis_rate = strtoul(optarg, &eptr, 0);
+			if (*eptr != '\0' || !analysis_rate)
+				bad_option("Analysis Rate");
+			break;
+		case OPT_ENGINE:
+			if (!strcmp(optarg, "auto"))
+				engine = NE_ENGINE_AUTO;
+			else if (!strcmp(optarg, "fft"))
+				engine = NE_ENGINE_FFT;
+			else if (!strcmp(optarg, "goertzel"))
+				engine = NE_ENGINE_GOERTZEL;
+			else if (!strcmp(optarg, "octave"))
+				engine = NE_ENGINE_OCTAVE;
+			else if (!strcmp(optarg, "q15"))
+				engine = NE_ENGINE_Q15;
+			else if (!strcmp(optarg, "zoom"))
+				engine = NE_ENGINE_ZOOM;
+			else
+				bad_option("Engine");
+			break;
+		case 'W':
+			waterfall_rows = strtoul(optarg, &eptr, 0);
+			if (*eptr != '\0' || waterfall_rows < 2)
+				bad_option("Waterfall Depth");
+			break;
+		case OPT_WATERFALL_BINS:
+			waterfall_bins = 1;
+			break;
+		case OPT_ATTACK:
+			attack_ms = strtof(optarg, &eptr);
+			if (*eptr != '\0' || attack_ms < 0.0f)
+				bad_option("Attack Time");
+			break;
+		case OPT_RELEASE:
+			release_ms = strtof(optarg, &eptr);
+			if (*eptr != '\0' || release_ms < 0.0f)
+				bad_option("Release Time");
+			break;
+		case OPT_HOLD:
+			hold_ms = strtof(optarg, &eptr);
+			if (*eptr != '\0' || hold_ms < 0.0f)
+				bad_option("Hold Time");
+			break;
+		case 'a':
+			analyze_channels = strtoul(optarg, &eptr, 0);
+			if (*eptr != '\0' || analyze_channels < 1)
+				bad_option("Analyzed Channels");
+			break;
+		case 'S':
+			if (!strcmp(optarg, "magn"))
+				spectrum_kind = NE_SPECTRUM_MAGN;
+			else if (!strcmp(optarg, "complex"))
+				spectrum_kind = NE_SPECTRUM_HALFCOMPLEX;
+			else
+				bad_option("Spectrum");
+			break;
+		case 'F':
+			fanout_slots = strtoul(optarg, &eptr, 0);
+			if (*eptr != '\0' || fanout_slots < 4)
+				bad_option("Fan-out Depth");
+			break;
+		case 'H':
+			hugepages = 1;
+			break;
+		case 'R':
+			if (parse_rt_role(optarg))
+				bad_option("Realtime Setup");
+			break;
+		case 'f':
+			if (!(raw_capture_data_file = strdup(optarg))) {
+				prerr("strdup(3)\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'o':
+			for (format = 0; format < SND_PCM_FORMAT_LAST; format++) {
+				const char *format_name =
+				    snd_pcm_format_name(format);
+
+				if (format_name)
+					if (!strcasecmp(format_name, optarg))
+						goto get_format;
+			}
+			usage( );
+
+get_format:
+			if (format == SND_PCM_FORMAT_LAST)
+				format = SND_PCM_FORMAT_S16;
+
+			if(snd_pcm_format_unsigned(format)){
+				prerr("Unsigned formats not supported\n");
+				exit(EXIT_FAILURE);
+			}
+
+			if(format == SND_PCM_FORMAT_FLOAT_LE ||
+			   format == SND_PCM_FORMAT_FLOAT_BE){
+				prerr("FLOAT formats unsupported %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+
+			if (!snd_pcm_format_linear(format)){
+				prerr("Invalid non-linear format %s\n",
+				       optarg);
+				exit(EXIT_FAILURE);
+			}
+			hwparams.format = format;
+			break;
+
+		case 'h':
+		default:
+			usage( );
+		}
+	}
+}
+
+/* dump PCM Plugin chain of software conversions to stdout */
+static int do_snd_pcm_dump(struct ne_capture_dev *d)
+{
+	snd_output_t *output = NULL;
+	int err = -1;
+
+	err = snd_output_stdio_attach(&output, stdout, 0);
+	if (err < 0) {
+		prerr("%s\n", snd_strerror(err));
+		goto exit;
+	}
+
+	snd_pcm_dump(d->handle, output);
+	printf("\n");
+
+	err = 0;
+exit:
+	return err;
+}
+
+#define __print_once_snd_pcm_state(d) \
+	do { \
+		if (!(d)->state_shown) do_snd_pcm_state(d); \
+		(d)->state_shown = 1; \
+	} while (0)
+
+static void do_snd_pcm_state(struct ne_capture_dev *d)
+{
+	if (!verbose && d->handle)
+		printf("%*s: %u\n", 30, "PCM Stream State",
+		       snd_pcm_state(d->handle));
+}
+
+static void sighandler(int sig)
+{
+	/* printf async-unsafe even with sigaction? */
+	fprintf(stderr, "%s:%d:: Received signal %d\n", __func__, __LINE__, sig);
+	done = 1;
+}
+
+/* "--record": create the log file, sized for "record_periods" periods */
+static int record_init(struct ne_capture_dev *d)
+{
+	struct ne_replay_log *log;
+	char name[PATH_MAX];
+	const char *path = dev_shm_name(d, record_file, name, sizeof(name));
+	size_t record_size, size;
+	int fd, err = -1;
+
+	record_size = NE_REPLAY_RECORD_SIZE(d->hwparams.period_frames,
+					    d->frame_bytes);
+	size = NE_REPLAY_LOG_SIZE(record_periods, record_size);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		prerr("%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (ftruncate(fd, size) < 0) {
+		prerr("%s\n", strerror(errno));
+		goto exit;
+	}
+	log = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (log == MAP_FAILED) {
+		prerr("%s\n", strerror(errno));
+		goto exit;
+	}
+
+	memcpy(log->magic, NE_REPLAY_MAGIC, sizeof(log->magic));
+	log->version = NE_REPLAY_VERSION;
+	log->format = d->hwparams.format;
+	log->rate = d->hwparams.rate;
+	log->channels = d->hwparams.channels;
+	log->period_frames = d->hwparams.period_frames;
+	log->frame_bytes = d->frame_bytes;
+	log->record_size = record_size;
+	log->flags = d->planar ? NE_REPLAY_PLANAR : 0;
+	log->capacity = record_periods;
+	d->log = log;
+	d->log_size = size;
+
+	if (!verbose)
+		printf("\n" "Period Log:" "\n%*s (recording)"
+		       "\n%*lu periods (%.1f s, %.1f MiB)" "\n",
+		       30, path, 30, record_periods, (double)record_periods *
+		       d->hwparams.period_frames / d->hwparams.rate,
+		       size / 1048576.0);
+	err = 0;
+exit:
+	close(fd);
+	return err;
+}
+
+/* "replay:": map a "--record" log; the stream takes its parameters */
+static int replay_open(struct ne_capture_dev *d)
+{
+	struct ne_analysis *an = d->an;
+	const char *file = d->src_arg;
+	struct ne_replay_log *log;
+	struct stat st;
+	int fd, err = -1;
+
+	if (record_file) {
+		prerr("\"%s\": can't record a replay\n", d->device);
+		return -1;
+	}
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		prerr("%s: %s\n", file, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		prerr("%s\n", strerror(errno));
+		goto exit;
+	}
+	if ((size_t)st.st_size < sizeof(*log)) {
+		prerr("%s: not a period log\n", file);
+		goto exit;
+	}
+	log = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (log == MAP_FAILED) {
+		prerr("%s\n", strerror(errno));
+		goto exit;
+	}
+	d->log = log;
+	d->log_size = st.st_size;
+
+	if (memcmp(log->magic, NE_REPLAY_MAGIC, sizeof(log->magic))
+	    || log->version != NE_REPLAY_VERSION || !log->capacity
+	    || log->frame_bytes != log->channels *
+	    (snd_pcm_format_physical_width(log->format) / 8)
+	    || log->record_size != NE_REPLAY_RECORD_SIZE(log->period_frames,
+							 log->frame_bytes)
+	    || NE_REPLAY_LOG_SIZE(log->capacity, log->record_size) >
+	    (size_t)st.st_size) {
+		prerr("%s: not a period log, or of another version\n", file);
+		goto exit;
+	}
+
+	d->hwparams.format = log->format;
+	d->hwparams.rate = log->rate;
+	d->hwparams.channels = log->channels;
+	d->hwparams.period_frames = log->period_frames;
+	d->planar = !!(log->flags & NE_REPLAY_PLANAR);
+	d->log_next = ne_replay_oldest(log);
+	if (an->analyze_channels > log->channels) {
+		prerr("can't analyze %u of %u channels\n", an->analyze_channels,
+		      log->channels);
 		goto exit;
 	}
 
-	ret = ftruncate(fd, filesize);
-	if (ret < 0) {
-		prerr("%s\n", strerror(errno));
-		goto exit;
+	if (!verbose)
+		printf("\n" "Period Log:" "\n%*s (replaying%s)"
+		       "\n%*llu periods, %s, %u Hz, %u channels, %u frames%s"
+		       "\n", 30, file, source_fast ? ", fast" : "", 30,
+		       (unsigned long long)(log->head - d->log_next),
+		       snd_pcm_format_name(log->format), log->rate,
+		       log->channels, log->period_frames,
+		       d->planar ? ", planar" : "");
+	err = 0;
+exit:
+	close(fd);
+	return err;
+}
+
+/* set up an open ALSA handle */
+static int alsa_setup(struct ne_capture_dev *d)
+{
+	do_snd_pcm_state(d);
+
+	/* setup hwparams */
+	if (set_hwparams(d))
+		return -1;
+
+	do_snd_pcm_state(d);
+	return 0;
+}
+
+/* "alsa:" */
+static int alsa_open(struct ne_capture_dev *d)
+{
+	int err;
+
+	/* open device */
+	if ((err = snd_pcm_open(&d->handle, d->src_arg, stream, 0)) < 0) {
+		prerr("pcm open error (%s)\n", snd_strerror(err));
+		return -1;
+	}
+	return alsa_setup(d);
+}
+
+static void alsa_close(struct ne_capture_dev *d)
+{
+	/* for graceful termination */
+	if (d->handle)
+		snd_pcm_close(d->handle);
+}
+
+/* "file:PATH" */
+static int file_open(struct ne_capture_dev *d)
+{
+	if ((d->fd = open(d->src_arg, O_RDONLY)) < 0) {
+		prerr("%s: %s\n", d->src_arg, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static void file_close(struct ne_capture_dev *d)
+{
+	if (d->fd > 0)
+		close(d->fd);
+}
+
+/* "stdin", or "-" */
+static int stdin_open(struct ne_capture_dev *d)
+{
+	d->fd = STDIN_FILENO;
+	return 0;
+}
+
+/*
+ * "synth:[KIND][,KEY=VAL...]" at the "-o", "-c", "-r" stream parameters.
+ * KIND: tones (default), sweep, noise or impulse. KEYs:
+ *	f=HZ[+HZ...]	tones (default 1000), sweep start+end (20+rate/2)
+ *	level=DBFS	per tone, sweep, impulse or noise, default -6
+ *	noise=DBFS	noise floor added to each channel
+ *	secs=S		sweep length (default 10), impulse interval (1)
+ *	jitter=MS	deliver each period up to MS late, at random
+ *	xrun=P		lose a period to a simulated overrun with chance P
+ */
+static int synth_open(struct ne_capture_dev *d)
+{
+	struct ne_synth *sy = &d->synth;
+	snd_pcm_format_t format = d->hwparams.format;
+	char *spec, *tok, *save, *val, *f, *eptr;
+	double x;
+	int err = -1;
+
+	if (snd_pcm_format_signed(format) != 1
+	    || snd_pcm_format_linear(format) != 1) {
+		prerr("synth: %s is not a signed linear format\n",
+		      snd_pcm_format_name(format));
+		return -1;
+	}
+	sy->bytes = snd_pcm_format_physical_width(format) / 8;
+	sy->big_endian = snd_pcm_format_big_endian(format) == 1;
+	sy->full_scale = (1U << (snd_pcm_format_width(format) - 1)) - 1.0;
+	sy->kind = NE_SYNTH_TONES;
+	sy->amp = pow(10.0, -6.0 / 20.0);
+	sy->rng = 0x9e3779b9U * (d->index + 1);
+
+	if (!(spec = strdup(d->src_arg))) {
+		prerr("strdup(3)\n");
+		return -1;
+	}
+	for (tok = strtok_r(spec, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		if ((val = strchr(tok, '=')))
+			*val++ = '\0';
+		if (!strcmp(tok, "tones") && !val)
+			sy->kind = NE_SYNTH_TONES;
+		else if (!strcmp(tok, "sweep") && !val)
+			sy->kind = NE_SYNTH_SWEEP;
+		else if (!strcmp(tok, "noise") && !val)
+			sy->kind = NE_SYNTH_NOISE;
+		else if (!strcmp(tok, "impulse") && !val)
+			sy->kind = NE_SYNTH_IMPULSE;
+		else if (!val)
+			goto bad;
+		else if (!strcmp(tok, "f")) {
+			for (sy->ntones = 0, f = val; *f; f = eptr) {
+				if (sy->ntones == NE_SYNTH_TONES_MAX)
+					goto bad;
+				x = strtod(f, &eptr);
+				if (eptr == f || x <= 0.0
+				    || x >= d->hwparams.rate / 2.0
+				    || (*eptr && *eptr++ != '+'))
+					goto bad;
+				sy->f[sy->ntones++] = x;
+			}
+		} else {
+			x = strtod(val, &eptr);
+			if (eptr == val || *eptr)
+				goto bad;
+			if (!strcmp(tok, "level"))
+				sy->amp = pow(10.0, x / 20.0);
+			else if (!strcmp(tok, "noise"))
+				sy->noise = pow(10.0, x / 20.0);
+			else if (!strcmp(tok, "secs") && x > 0.0)
+				sy->secs = x;
+			else if (!strcmp(tok, "jitter") && x >= 0.0)
+				sy->jitter_ns = x * 1e6;
+			else if (!strcmp(tok, "xrun") && x >= 0.0 && x <= 1.0)
+				sy->xrun_p = x;
+			else
+				goto bad;
+		}
 	}
 
-	map = mmap(0, filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (map == MAP_FAILED) {
-		prerr("%s\n", strerror(errno));
-		goto exit;
+	/* per kind defaults */
+	if (sy->kind == NE_SYNTH_TONES && !sy->ntones)
+		sy->f[sy->ntones++] = 1000.0;
+	if (sy->kind == NE_SYNTH_SWEEP) {
+		if (!sy->ntones) {
+			sy->f[0] = 20.0;
+			sy->f[1] = d->hwparams.rate / 2.0;
+		} else if (sy->ntones != 2)
+			goto bad;
+	}
+	if (!sy->secs)
+		sy->secs = sy->kind == NE_SYNTH_SWEEP ? 10.0 : 1.0;
+	if (sy->kind == NE_SYNTH_IMPULSE) {
+		sy->interval = sy->secs * d->hwparams.rate + 0.5;
+		if (sy->interval < 1) {
+			prerr("synth: impulse interval %gs is under a frame\n",
+			      sy->secs);
+			goto exit;
+		}
 	}
 
-	close(fd);
-	return map;
+	if (!verbose)
+		printf("\n" "Synthetic Source:" "\n%*s (%s, %u Hz, %u channels)"
+		       "\n", 30, d->src_arg, snd_pcm_format_name(format),
+		       d->hwparams.rate, d->hwparams.channels);
+	err = 0;
+	goto exit;
+bad:
+	prerr("bad synth spec \"%s\"\n", d->src_arg);
 exit:
-	return NULL;
+	free(spec);
+	return err;
 }
 
-static int set_hwparams(void)
+enum {
+	NE_SOURCE_ALSA,
+	NE_SOURCE_FILE,
+	NE_SOURCE_STDIN,
+	NE_SOURCE_SYNTH,
+	NE_SOURCE_REPLAY,
+};
+static const struct ne_source ne_sources[] = {
+	[NE_SOURCE_ALSA] = {"alsa", alsa_open, alsa_read, alsa_close},
+	[NE_SOURCE_FILE] = {"file", file_open, file_read, file_close},
+	[NE_SOURCE_STDIN] = {"stdin", stdin_open, file_read, NULL},
+	[NE_SOURCE_SYNTH] = {"synth", synth_open, synth_read, NULL},
+	[NE_SOURCE_REPLAY] = {"replay", replay_open, replay_read, NULL},
+};
+
+/* "-D [SOURCE:]ARG": ALSA unless the name starts with a source's */
+static void source_select(struct ne_capture_dev *d)
 {
-	ssize_t err = -1;
-	unsigned int channels = hwparams.channels;
-	unsigned int rrate, rate = hwparams.rate;
-	snd_pcm_format_t format = hwparams.format;
-	snd_pcm_uframes_t *period_size = &hwparams.period_frames;
-	snd_pcm_uframes_t buffer_size;
+	size_t i, n;
 
-	snd_pcm_hw_params_t *params;
-	snd_pcm_hw_params_alloca(&params);
+	d->src = &ne_sources[NE_SOURCE_ALSA];
+	d->src_arg = d->device;
+	if (!strcmp(d->device, "-")) {
+		d->src = &ne_sources[NE_SOURCE_STDIN];
+		return;
+	}
+	for (i = 0; i < sizeof(ne_sources) / sizeof(ne_sources[0]); i++) {
+		n = strlen(ne_sources[i].name);
+		if (strncmp(d->device, ne_sources[i].name, n)
+		    || (d->device[n] && d->device[n] != ':'))
+			continue;
+		d->src = &ne_sources[i];
+		d->src_arg = d->device + n + !!d->device[n];
+		return;
+	}
+}
 
-	err = snd_pcm_hw_params_any(handle, params);
-	if (err < 0) {
-		prerr("%s\n", snd_strerror(err));
-		goto exit;
+/* open and set up one capture device and all of its buffers and shm */
+static int dev_init(struct ne_capture_dev *d)
+{
+	size_t filesize;
+	char name[NAME_MAX];
+	unsigned int channels;
+	snd_pcm_format_t format;
+	struct ne_analysis *an;
+
+	printf("Capture device is: \"%s\"", d->device);
+	if (*d->ns)
+		printf(" (shm namespace \"%s\")", d->ns);
+	printf("\n");
+	an = d->an = calloc(1, sizeof(*an));
+	if (!an) {
+		prerr("calloc(3) failed!\n");
+		return -1;
 	}
+	an->nbands = nbands;
+	an->fband_hz = fband_hz;
+	an->analyze_channels = analyze_channels;
+	an->n_points = d->hwparams.period_frames;
+	if (analysis_rate)
+		d->hwparams.period_frames = capture_period(d);
 
-	err = snd_pcm_hw_params_set_access(handle, params,
-					   SND_PCM_ACCESS_RW_INTERLEAVED);
-	if (err < 0) {
-		prerr("%s\n", snd_strerror(err));
-		goto exit;
+	/* open the source; it may set the stream parameters */
+	source_select(d);
+	if (d->src->open(d))
+		return -1;
+	channels = d->hwparams.channels;
+	format = d->hwparams.format;
+
+	if (resample_init(d))
+		return -1;
+	kernels_init(d);
+
+	/* PCM period, deinterleaved per-channel PCM and fft buffers */
+	if (engine_select(d) || arena_init(d))
+		return -1;
+
+	/* shm ipc for "ne_glprog" */
+	filesize = sysconf(_SC_PAGE_SIZE);
+	filesize = (NE_GLPROG_FBAND_DATA_SIZE + filesize - 1) & ~(filesize - 1);
+	d->ne_glprog_fband_data_map = 
+		shm_init(dev_shm_name(d, NE_GLPROG_FBAND_DATA_FILE, name,
+				      sizeof(name)), filesize);
+	if(!d->ne_glprog_fband_data_map)
+		return -1;
+	fband_layout_publish(d);
+
+	/* shm ipc for a plotting program (e.g. "gnuplot(1)") */
+	if(raw_capture_data_file){
+		if((snd_pcm_format_physical_width(format) / 8) > (int)sizeof(int32_t)){
+			prerr("maximum supported sample format width for plotting is 32bits\n");
+			return -1;
+		}
+	
+		filesize = d->hwparams.period_frames * channels * sizeof(int32_t);
+		an->raw_capture_data_map = 
+			shm_init(dev_shm_name(d, raw_capture_data_file, name,
+					      sizeof(name)), filesize);
+		if (!an->raw_capture_data_map)
+			return -1;
+		an->raw_capture_data_size = filesize;
 	}
 
-	err = snd_pcm_hw_params_set_format(handle, params, format);
-	if (err < 0) {
-		prerr("%s\n", snd_strerror(err));
-		goto exit;
+	/* initialize analysis engine */
+	if (engine_init(d))
+		return -1;
+	window_init(d, an->tune);
+	ballistics_init(d, an->tune);
+	pool_init(d);
+
+	/* shm ipc for spectrogram history */
+	if (waterfall_rows && waterfall_init(d))
+		return -1;
+
+	/* shm ipc for full-resolution spectrum consumers */
+	if (spectrum_kind >= 0 && spectrum_init(d))
+		return -1;
+
+	/* shm ipc for fan-out readers */
+	if (fanout_slots && fanout_init(d))
+		return -1;
+
+	/* period log */
+	if (record_file && record_init(d))
+		return -1;
+
+	if (verbose > 0)
+		if (do_snd_pcm_dump(d))
+			return -1;
+
+	return 0;
+}
+
+static void dev_fini(struct ne_capture_dev *d)
+{
+	if (d->src && d->src->close)
+		d->src->close(d);
+
+	if (d->an && d->an->arena.base)
+		munmap(d->an->arena.base, d->an->arena.size);
+	if (d->log)
+		munmap(d->log, d->log_size);
+}
+
+/* ============================================== *
+ *            RUNTIME RECONFIGURATION             *
+ * ============================================== */
+
+/* what a "--control" command changes; 0 keeps the device's */
+struct ne_reconfig {
+	int nbands;
+	unsigned int analyze_channels;
+	snd_pcm_uframes_t period_frames;
+	int n_points;		/* "--analysis-rate": the period follows */
+};
+
+/*
+ * A new analysis for the capture thread to take over, with the stream it
+ * was built for: the ALSA handle reopened at a new period size (NULL to
+ * keep the device's), the period size and access. analysis_swap() trades
+ * them for the device's own, which are then the caller's to release.
+ */
+struct ne_swap {
+	struct ne_analysis *an;
+	snd_pcm_t *handle;
+	snd_pcm_uframes_t period_frames;
+	int planar;
+};
+
+/*
+ * Fresh shm segments for "t"'s analysis where it no longer fits those of
+ * "o", under the same names: unlinked first, so that "o" keeps writing
+ * its own until the swap. Readers of an old segment see its version
+ * zeroed once it is retired, see analysis_free().
+ */
+static int shm_rebuild(const struct ne_analysis *o, struct ne_capture_dev *t)
+{
+	char name[NAME_MAX];
+	struct ne_analysis *n = t->an;
+	unsigned int n_points = n->n_points;
+	unsigned int cols = waterfall_bins ? n_points / 2 + 1 :
+	    (unsigned int)n->nbands;
+	const struct ne_glprog_waterfall *wf = o->waterfall_map;
+	const struct ne_alsa_spectrum *sp = o->spectrum_map;
+	const struct ne_alsa_fanout *fo = o->fanout_map;
+	size_t filesize = t->hwparams.period_frames * t->hwparams.channels *
+	    sizeof(int32_t);
+
+	if (wf && (wf->cols != cols || wf->row_ms != 1000.0f *
+		   t->hwparams.period_frames / t->hwparams.rate)) {
+		shm_unlink(dev_shm_name(t, NE_GLPROG_WATERFALL_FILE, name,
+					sizeof(name)));
+		if (waterfall_init(t))
+			return -1;
 	}
-	err = snd_pcm_hw_params_set_channels(handle, params, channels);
-	if (err < 0) {
-		prerr("%s\n", snd_strerror(err));
-		goto exit;
+	if (sp && (sp->n_points != n_points ||
+		   sp->channels != n->analyze_channels)) {
+		shm_unlink(dev_shm_name(t, NE_ALSA_SPECTRUM_FILE, name,
+					sizeof(name)));
+		if (spectrum_init(t))
+			return -1;
 	}
-
-	rrate = rate;
-	err = snd_pcm_hw_params_set_rate_near(handle, params, &rrate, 0);
-	if (err < 0) {
-		prerr("Rate %iHz not available for playback: %s\n", rate,
-		      snd_strerror(err));
-		goto exit;
+	if (fo && (fo->channels != n->analyze_channels ||
+		   fo->nbands != (uint32_t)n->nbands)) {
+		shm_unlink(dev_shm_name(t, NE_ALSA_FANOUT_FILE, name,
+					sizeof(name)));
+		if (fanout_init(t))
+			return -1;
 	}
-	if (rrate != rate) {
-		prerr("Rate doesn't match (requested %iHz, got %iHz)\n", rate,
-		      rrate);
-		err = -EINVAL;
-		goto exit;
+	if (o->raw_capture_data_map && o->raw_capture_data_size != filesize) {
+		dev_shm_name(t, raw_capture_data_file, name, sizeof(name));
+		shm_unlink(name);
+		if (!(n->raw_capture_data_map = shm_init(name, filesize)))
+			return -1;
+		n->raw_capture_data_size = filesize;
 	}
+	return 0;
+}
 
-	err = snd_pcm_hw_params_set_period_size_near(handle, params,
-						     period_size, 0);
-	if (err < 0) {
-		prerr("%s\n", snd_strerror(err));
-		goto exit;
+/* release analysis "o" and what it holds that "keep" doesn't: a retired
+ * one, or one that never got swapped in */
+static void analysis_free(struct ne_analysis *o, const struct ne_analysis *keep)
+{
+	struct ne_glprog_waterfall *wf = o->waterfall_map;
+	struct ne_alsa_spectrum *sp = o->spectrum_map;
+	struct ne_alsa_fanout *fo = o->fanout_map;
+
+	if (o->arena.base && o->arena.base != keep->arena.base)
+		munmap(o->arena.base, o->arena.size);
+#ifdef FFTW3
+	if (o->plan_rc && o->plan_rc != keep->plan_rc)
+		fftwf_destroy_plan(o->plan_rc);
+	if (o->plan_cc && o->plan_cc != keep->plan_cc)
+		fftwf_destroy_plan(o->plan_cc);
+	if (o->plan_oct && o->plan_oct != keep->plan_oct)
+		fftwf_destroy_plan(o->plan_oct);
+	if (o->plan_zoom && o->plan_zoom != keep->plan_zoom)
+		fftwf_destroy_plan(o->plan_zoom);
+#else
+	if (o->plan_rc && o->plan_rc != keep->plan_rc)
+		rfftw_destroy_plan(o->plan_rc);
+	if (o->plan_cc && o->plan_cc != keep->plan_cc)
+		fftw_destroy_plan(o->plan_cc);
+	if (o->plan_oct && o->plan_oct != keep->plan_oct)
+		rfftw_destroy_plan(o->plan_oct);
+	if (o->plan_zoom && o->plan_zoom != keep->plan_zoom)
+		fftw_destroy_plan(o->plan_zoom);
+#endif
+	/* the command line's tables are shared by all devices */
+	if (o->fband_hz != keep->fband_hz && o->fband_hz != fband_hz
+	    && o->fband_hz != ne_glprog_fband)
+		free(o->fband_hz);
+
+	if (wf && wf != keep->waterfall_map) {
+		__atomic_store_n(&wf->version, 0, __ATOMIC_RELEASE);
+		munmap(wf, NE_GLPROG_WATERFALL_SIZE(wf->rows, wf->cols));
 	}
-#if 0
-	/* we need not concern ourselves with calculating/specifying
-	 * a usable h/w ring buffer size since ALSA runtime
-	 * is quite capable of determining a suitable value for us.
-	 *
-	 * Otherwise, do something like...
-	 */
-	err = snd_pcm_hw_params_set_buffer_size_near(handle, params,
-						     &buffer_frames);
-	if (err < 0) {
-		prerr("%s\n", snd_strerror(err));
-		goto exit;
+	if (sp && sp != keep->spectrum_map) {
+		__atomic_store_n(&sp->version, 0, __ATOMIC_RELEASE);
+		munmap(sp, NE_ALSA_SPECTRUM_SIZE(sp->value_size, sp->channels,
+						 sp->nvals));
 	}
-#endif
+	if (fo && fo != keep->fanout_map) {
+		__atomic_store_n(&fo->version, 0, __ATOMIC_RELEASE);
+		munmap(fo, NE_ALSA_FANOUT_SIZE(fo->slots, fo->slot_size));
+	}
+	if (o->raw_capture_data_map &&
+	    o->raw_capture_data_map != keep->raw_capture_data_map)
+		munmap(o->raw_capture_data_map, o->raw_capture_data_size);
+	free(o);
+}
 
-	err = snd_pcm_hw_params(handle, params);
-	if (err < 0) {
-		prerr("%s\n", snd_strerror(err));
-		goto exit;
+/*
+ * A copy of analysis "o" changed as "rc" says, for "t", a copy of its
+ * device: nothing it owns yet, and t's period size the one to reopen
+ * the stream with.
+ */
+static struct ne_analysis *analysis_new(struct ne_capture_dev *t,
+					const struct ne_analysis *o,
+					const struct ne_reconfig *rc)
+{
+	struct ne_analysis *n;
+
+	if (!(n = malloc(sizeof(*n)))) {
+		prerr("malloc(3) failed!\n");
+		return NULL;
+	}
+	*n = *o;
+	n->plan_rc = NULL;
+	n->plan_cc = NULL;
+	n->plan_oct = NULL;
+	n->plan_zoom = NULL;
+	n->arena.base = NULL;
+	n->folded = 0;
+	n->feat_folded = 0;
+	t->an = n;
+	if (rc->nbands) {
+		if (!(n->fband_hz = fband_table(rc->nbands))) {
+			analysis_free(n, o);
+			return NULL;
+		}
+		n->nbands = rc->nbands;
 	}
+	if (rc->analyze_channels)
+		n->analyze_channels = rc->analyze_channels;
+	if (rc->n_points)
+		n->n_points = rc->n_points;
+	if (rc->period_frames)
+		t->hwparams.period_frames = rc->period_frames;
+	else if (rc->n_points)
+		t->hwparams.period_frames = capture_period(t);
+	return n;
+}
 
-	snd_pcm_hw_params_get_buffer_size(params, &buffer_size);
-	if (*period_size == buffer_size) {
-		prerr("Can't use period equal to buffer size (%lu == %lu)",
-		      *(unsigned long *)period_size,
-		      (unsigned long)buffer_size);
-		err = -1;
-		goto exit;
+/*
+ * Build the analysis of "t" (see analysis_new()) for the stream it will
+ * see: kernels, buffer arena, engine (fft plans, window, band tables),
+ * ballistics, pool tasks and whatever shm no longer fits that of "o",
+ * the device's.
+ */
+static int analysis_build(struct ne_capture_dev *t,
+			  const struct ne_analysis *o)
+{
+	if (resample_init(t))
+		return -1;
+	kernels_init(t);
+	if (engine_select(t) || arena_init(t) || engine_init(t))
+		return -1;
+	window_init(t, t->an->tune);
+	ballistics_init(t, t->an->tune);
+	pool_init(t);
+	return shm_rebuild(o, t);
+}
+
+/*
+ * Capture thread, between two periods (or the main thread, while the
+ * capture thread is parked): take over the analysis and stream in "sw",
+ * leaving the device's own there in exchange. The bands' ballistics
+ * carry over where their layout stays.
+ */
+static void analysis_swap(struct ne_capture_dev *d, struct ne_swap *sw)
+{
+	struct ne_analysis *o = d->an, *n = sw->an;
+	snd_pcm_t *handle = d->handle;
+
+	if (n->analyze_channels == o->analyze_channels
+	    && n->nbands == o->nbands) {
+		memcpy(n->band_out, o->band_out,
+		       n->analyze_channels * n->nbands * sizeof(float));
+		memcpy(n->band_hold, o->band_hold,
+		       n->analyze_channels * n->nbands * sizeof(float));
 	}
+	if (sw->handle) {
+		d->handle = sw->handle;
+		sw->handle = handle;
+	}
+	d->hwparams.period_frames = sw->period_frames;
+	d->planar = sw->planar;
+	d->an = n;
+	sw->an = o;
+	fband_layout_publish(d);
+}
 
-	if (!verbose)
-		printf("\n" "Accepted HWPARAMS:\n%*iHz (%s)"
-		       "\n%*s (%s)"
-		       "\n%*i (%s)"
-		       "\n%*lu (%s)"
-		       "\n%*lu (%s)"
-		       "\n",
-		       28, rate, "sampling rate",
-		       30, snd_pcm_format_name(format), "sample format",
-		       30, channels, "number of channels",
-		       30, buffer_size, "h/w ring buffer size in frames",
-		       30, *period_size, "period size in frames");
+/* "park": the capture thread waits, off the device, until let go */
+static void capture_park(struct ne_capture_dev *d)
+{
+	__atomic_store_n(&d->parked, 1, __ATOMIC_RELEASE);
+	while (__atomic_load_n(&d->park, __ATOMIC_ACQUIRE))
+		syscall(SYS_futex, &d->park, FUTEX_WAIT_PRIVATE, 1,
+			NULL, NULL, 0);
+	__atomic_store_n(&d->parked, 0, __ATOMIC_RELEASE);
+}
 
-	err = 0;
-exit:
-	return err;
+/* main thread: park device "d"'s capture thread, or let it go; 0 once it
+ * got there, -1 if the capture ended meanwhile */
+static int park(struct ne_capture_dev *d, uint32_t on)
+{
+	struct timespec tick = {.tv_sec = 0,.tv_nsec = 1000 * 1000 };
+
+	__atomic_store_n(&d->park, on, __ATOMIC_RELEASE);
+	if (!on)
+		syscall(SYS_futex, &d->park, FUTEX_WAKE_PRIVATE, 1,
+			NULL, NULL, 0);
+	while (__atomic_load_n(&d->parked, __ATOMIC_ACQUIRE) != on) {
+		if (done) {
+			if (on)
+				park(d, 0);
+			return -1;
+		}
+		nanosleep(&tick, NULL);
+	}
+	return 0;
 }
 
-static ssize_t alloc_period_pcm_buf(void)
+/*
+ * ALSA: a new period size is a new hw configuration, opened into "t"
+ * alongside the running one where the device allows. A busy one (hw:
+ * takes one open at a time) has the capture thread parked and its
+ * handle closed first, "*parked" set; see pcm_restore() should the new
+ * one fail.
+ */
+static int pcm_reopen(struct ne_capture_dev *d, struct ne_capture_dev *t,
+		      int *parked)
 {
-	ssize_t err = -1;
-	snd_pcm_uframes_t period_size = hwparams.period_frames;
-	uint32_t channels = hwparams.channels;
-	snd_pcm_format_t format = hwparams.format;
-	unsigned long fmt_phys_width_bits =
-	    snd_pcm_format_physical_width(format);
-	unsigned long fmt_phys_width_bits_per_frame =
-	    fmt_phys_width_bits * channels;
-	unsigned long chunk_bytes =
-	    period_size * fmt_phys_width_bits_per_frame / 8;
+	int err;
 
-	audiobuf = calloc(chunk_bytes, sizeof(u_char));
-	if (audiobuf == NULL) {
-		prerr("Insufficient memory");
-		goto exit;
+	err = snd_pcm_open(&t->handle, t->src_arg, stream, SND_PCM_NONBLOCK);
+	if (err == -EBUSY) {
+		if (park(d, 1))
+			return -1;
+		*parked = 1;
+		alsa_close(d);
+		d->handle = NULL;
+		err = snd_pcm_open(&t->handle, t->src_arg, stream,
+				   SND_PCM_NONBLOCK);
+	}
+	if (err < 0) {
+		prerr("pcm open error (%s)\n", snd_strerror(err));
+		t->handle = NULL;
+		return -1;
+	}
+	if ((err = snd_pcm_nonblock(t->handle, 0)) < 0) {
+		prerr("pcm nonblock error (%s)\n", snd_strerror(err));
+		return -1;
 	}
+	return alsa_setup(t);
+}
 
-	if (!verbose)
-		printf("\n" "PCM Data Transfer Stats:"
-		       "\n%*lu bits/sample, %lu bits/frame"
-		       "\n%*lu period size in bytes (pcm data transfer size)"
-		       "\n", 30, fmt_phys_width_bits,
-		       fmt_phys_width_bits_per_frame, 30, chunk_bytes);
+/* a parked device's own handle back as it was, after a failed reopen */
+static int pcm_restore(struct ne_capture_dev *d)
+{
+	snd_pcm_uframes_t period_frames = d->hwparams.period_frames;
+	int planar = d->planar;
 
-	err = 0;
-exit:
-	return err;
+	if (alsa_open(d) || d->hwparams.period_frames != period_frames
+	    || d->planar != planar) {
+		prerr("\"%s\": can't go on with period size %lu\n", d->device,
+		      (unsigned long)period_frames);
+		done = 1;
+		return -1;
+	}
+	return 0;
 }
 
-static ssize_t alloc_chnldata_buf(void)
+/*
+ * Main thread: rebuild device "d"'s analysis, for a reopened stream if
+ * its period size changes, and hand it over to the capture thread; once
+ * it has taken it (or from here while it is parked) release the old
+ * analysis and handle. Nothing here runs on the capture thread but the
+ * swap itself.
+ */
+static int reconfigure(struct ne_capture_dev *d, const struct ne_reconfig *rc)
 {
-	ssize_t err = -1;
-	int channels = hwparams.channels;
-	unsigned int period_size = hwparams.period_frames;
+	struct ne_capture_dev *t;
+	struct ne_swap *sw;
+	struct timespec tick = {.tv_sec = 0,.tv_nsec = 1000 * 1000 };
+	int parked = 0, err = -1;
 
-	chnldata = calloc(period_size * channels, sizeof(float));
-	if (!chnldata) {
-		prerr("calloc(3) failed!\n");
+	t = malloc(sizeof(*t));
+	sw = calloc(1, sizeof(*sw));
+	if (!t || !sw) {
+		prerr("malloc(3) failed!\n");
 		goto exit;
 	}
+	*t = *d;
+	t->handle = NULL;
+	printf("\n" "Reconfiguring \"%s\":" "\n", d->device);
+	if (!(sw->an = analysis_new(t, d->an, rc)))
+		goto exit;
+	if (d->handle && t->hwparams.period_frames != d->hwparams.period_frames
+	    && pcm_reopen(d, t, &parked))
+		goto fail;
+	if (analysis_build(t, d->an))
+		goto fail;
+	sw->handle = t->handle;
+	sw->period_frames = t->hwparams.period_frames;
+	sw->planar = t->planar;
 
+	if (parked) {
+		analysis_swap(d, sw);
+		park(d, 0);
+	} else {
+		__atomic_store_n(&d->next, sw, __ATOMIC_RELEASE);
+		while (__atomic_load_n(&d->next, __ATOMIC_ACQUIRE)) {
+			/* the capture is over; leave it all to the exit */
+			if (done)
+				return -1;
+			nanosleep(&tick, NULL);
+		}
+	}
+	if (sw->handle)
+		snd_pcm_close(sw->handle);
+	analysis_free(sw->an, d->an);
 	err = 0;
+	goto exit;
+fail:
+	if (t->handle)
+		snd_pcm_close(t->handle);
+	analysis_free(sw->an, d->an);
+	if (parked) {
+		pcm_restore(d);
+		park(d, 0);
+	}
 exit:
+	free(t);
+	free(sw);
 	return err;
 }
 
-static const char *prog;
-static void usage( )
+/*
+ * Main thread: retune device "d"'s analysis, its new ballistics and
+ * window filled into the tuning the capture thread doesn't use and
+ * posted for it to take over between two periods.
+ */
+static int retune(struct ne_capture_dev *d)
 {
-	fprintf(stderr, "\n" "Usage: %s [OPTIONS]\n"
-			   "\n\n"
-				 "OPTIONS:\n"
-	       "-h,--help         This menu\n"
-	       "-D,--device       Virtual PCM device, e.g. \"plguhw:0,0\", \"default\", etc\n"
-	       "-r,--rate         Sample rate in Hz, e.g. 44100\n"
-	       "-c,--channels     Channel count, e.g. 2 for stereo\n"
-	       "-b,--buffer-size  H/W Ring buffer size in frames (not used)\n"
-	       "-p,--period-size  Period size in frames, e.g. 1024\n"
-	       "-o,--format       Sample format, e.g. \"S16_LE\", \"U32_BE\", etc\n"
-				 "-f,--dumpfile     Raw capture data dump file (posix shm)\n"
-	       "-v,--verbose      Display PCM S/W conversions\n" "\n", prog);
+	struct ne_analysis *an = d->an;
+	struct ne_tuning *tn = &an->tuning[an->tune == &an->tuning[0]];
+	struct timespec tick = {.tv_sec = 0,.tv_nsec = 1000 * 1000 };
 
-	fprintf(stderr, "Recognized sample formats are: "
-	"S16_LE S16_BE S24_LE S24_BE S32_LE S32_BE");
-	fprintf(stderr, "\n\n");
-	exit(EXIT_SUCCESS);
+	window_init(d, tn);
+	ballistics_init(d, tn);
+	__atomic_store_n(&an->retune, tn, __ATOMIC_RELEASE);
+	while (__atomic_load_n(&an->retune, __ATOMIC_ACQUIRE)) {
+		if (done)
+			return -1;
+		nanosleep(&tick, NULL);
+	}
+	return 0;
 }
 
-static void bad_option(const char *option)
+/*
+ * "--control": one "KEY VALUE" line, for every device:
+ *	bands N		display bands, as "-B"
+ *	analyze N	analyzed channels, as "-a"
+ *	window NAME	as "--window"
+ *	attack MS, release MS, hold MS	band ballistics
+ *	period N	period size in frames, or the fft size with
+ *			"--analysis-rate"; reopens ALSA devices
+ * A window or ballistics change only retunes the analysis, see retune();
+ * the others rebuild it, see reconfigure().
+ */
+static void control_command(char *line)
 {
-	fprintf(stderr, "\n\tBad option \"%s\"\n", option);
-	usage();
+	struct ne_reconfig rc = { 0 };
+	char *key, *arg = NULL, *save, *veptr, *meptr;
+	unsigned long val;
+	float ms;
+	int i, tune = 1;
+
+	if (!(key = strtok_r(line, " \t\r", &save)))
+		return;
+	if (!(arg = strtok_r(NULL, " \t\r", &save))
+	    || strtok_r(NULL, " \t\r", &save))
+		goto bad;
+	/* a count, or ms */
+	val = strtoul(arg, &veptr, 0);
+	ms = strtof(arg, &meptr);
+
+	if (!strcmp(key, "bands")) {
+		if (ntones) {
+			prwarn("control: \"-T\" tones are the bands\n");
+			return;
+		}
+		if (*veptr != '\0' || val < 2 || val > NE_GLPROG_FBANDS_MAX)
+			goto bad;
+		rc.nbands = val;
+		tune = 0;
+	} else if (!strcmp(key, "analyze")) {
+		for (i = 0; i < ndevs; i++)
+			if (*veptr != '\0' || val < 1
+			    || val > devs[i].hwparams.channels)
+				goto bad;
+		rc.analyze_channels = val;
+		tune = 0;
+	} else if (!strcmp(key, "period")) {
+		if (record_file || link_devices) {
+			prwarn("control: no period change with \"--record\" "
+			       "or \"-L\"\n");
+			return;
+		}
+		for (i = 0; i < ndevs; i++)
+			if (devs[i].src == &ne_sources[NE_SOURCE_REPLAY]) {
+				prwarn("control: \"%s\" replays at its "
+				       "recorded period size\n",
+				       devs[i].device);
+				return;
+			}
+		if (*veptr != '\0' || val < 2)
+			goto bad;
+		if (analysis_rate)
+			rc.n_points = val;
+		else
+			rc.period_frames = val;
+		tune = 0;
+	} else if (!strcmp(key, "window")) {
+		for (i = NE_WINDOW_BLACKMAN; i > 0; i--)
+			if (!strcmp(arg, window_name[i]))
+				break;
+		if (strcmp(arg, window_name[i]))
+			goto bad;
+		window_kind = i;
+	} else if (*meptr != '\0' || ms < 0.0f)
+		goto bad;
+	else if (!strcmp(key, "attack"))
+		attack_ms = ms;
+	else if (!strcmp(key, "release"))
+		release_ms = ms;
+	else if (!strcmp(key, "hold"))
+		hold_ms = ms;
+	else
+		goto bad;
+
+	for (i = 0; i < ndevs && !done; i++)
+		if (tune ? retune(&devs[i]) : reconfigure(&devs[i], &rc))
+			prwarn("control: \"%s %s\" failed for \"%s\"\n", key,
+			       arg, devs[i].device);
+	return;
+bad:
+	prwarn("control: bad command \"%s%s%s\"\n", key, arg ? " " : "",
+	       arg ? arg : "");
 }
 
-static int set_prio(int prio)
+/* "--control": create the fifo, unless there is one */
+static int control_open(void)
 {
-	struct sched_param param;
-	param.sched_priority = prio;
-	if (sched_setscheduler(0, SCHED_FIFO, &param)) {
-		prwarn("%s\n", strerror(errno));
+	if (mkfifo(control_file, 0600) < 0 && errno != EEXIST) {
+		prerr("%s: %s\n", control_file, strerror(errno));
+		return -1;
+	}
+	/* read-write: no end of file while no writer has it open */
+	control_fd = open(control_file, O_RDWR | O_NONBLOCK);
+	if (control_fd < 0) {
+		prerr("%s: %s\n", control_file, strerror(errno));
 		return -1;
 	}
+	if (!verbose)
+		printf("\n" "Control FIFO:" "\n%*s" "\n", 30, control_file);
 	return 0;
 }
 
-#define MAX_SAFE_STACK (8 * 1024)
-static void stack_prefault(void)
+/* "--control": run the complete lines written to the fifo so far */
+static void control_poll(void)
 {
-	unsigned char dummy[MAX_SAFE_STACK];
-	memset(&dummy, 0, MAX_SAFE_STACK);
-	return;
+	static char line[256];
+	static size_t len = 0;
+	char *nl;
+	ssize_t r;
+
+	while ((r = read(control_fd, line + len,
+			 sizeof(line) - 1 - len)) > 0) {
+		len += r;
+		line[len] = '\0';
+		while ((nl = strchr(line, '\n'))) {
+			*nl = '\0';
+			control_command(line);
+			len -= nl + 1 - line;
+			memmove(line, nl + 1, len + 1);
+		}
+		if (len == sizeof(line) - 1) {
+			prwarn("control: line too long\n");
+			len = 0;
+		}
+	}
 }
 
-static int go_rt(void)
-{
-	int err = -1;
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
 
-	/* SCHED_FIFO: 1 for min prio; 99 for max prio */
-#define SCHED_FIFO_PRIO_VAL 40
-	if (set_prio(SCHED_FIFO_PRIO_VAL))
-		goto exit;
+static inline void pool_task(struct ne_capture_dev *d, struct ne_scratch *s,
+			     uint32_t t)
+{
+	struct ne_analysis *an = d->an;
+	struct ne_pool *p = &d->pool;
+	int lo, hi, n = an->analyze_channels * an->nbands;
 
-	/* prevent being paged out during rt execution */
-	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
-		prwarn("%s\n", strerror(errno));
-		goto exit;
+	if (p->phase == NE_POOL_ANALYZE) {
+		analyze_channel(d, s, t * an->step);
+		return;
 	}
+	lo = t * NE_POOL_CHUNK;
+	hi = lo + NE_POOL_CHUNK < n ? lo + NE_POOL_CHUNK : n;
+	do_ballistics(d, lo, hi);
+}
 
-	/* prefault program stack */
-	stack_prefault();
+/* drain participant "id"'s queue, then steal from the others' */
+static inline void pool_work(struct ne_capture_dev *d, int id)
+{
+	struct ne_pool *p = &d->pool;
+	struct ne_scratch *s = &d->an->scratch[id];
+	struct ne_pool_queue *q;
+	int i, n = p->workers + 1;
+	uint32_t t;
 
-	err = 0;
-exit:
-	return err;
+	for (i = 0; i < n; i++) {
+		q = &p->q[(id + i) % n];
+		while ((t = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED))
+		       < q->end)
+			pool_task(d, s, t);
+	}
 }
 
-static void do_getopt_long(int argc, char *const *argv)
+/*
+ * Run one phase on the capture thread and the workers, back when every
+ * task is done. Results land at fixed places (per channel spectra and
+ * levels, per chunk bands), so the output does not depend on who ran
+ * what.
+ */
+static inline void pool_run(struct ne_capture_dev *d, int phase)
 {
-	snd_pcm_format_t format;
-	struct option long_option[] = {
-		{"help", 0, NULL, 'h'},
-		{"device", 1, NULL, 'D'},
-		{"rate", 1, NULL, 'r'},
-		{"channels", 1, NULL, 'c'},
-		{"buffer-size", 1, NULL, 'b'},
-		{"period-size", 1, NULL, 'p'},
-		{"format", 1, NULL, 'o'},
-		{"verbose", 0, NULL, 'v'},
-		{"dumpfile", 1, NULL, 'f'},
-		{NULL, 0, NULL, 0},
-	};
-	char *eptr;
+	struct ne_pool *p = &d->pool;
+	uint32_t i, n = p->workers + 1, ntasks = d->an->ntasks[phase];
+	uint32_t gen = ++p->gen;
 
-	for (;;) {
-		int c;
-		if ((c =
-		     getopt_long(argc, argv, "hD:r:c:b:p:o:f:v",
-				 long_option, NULL)) < 0)
-			break;
-		switch (c) {
-		case 'D':
-			if (!(device = strdup(optarg))) {
-				prerr("strdup(3)\n");
-				exit(EXIT_FAILURE);
-			}
-			break;
-		case 'r':
-			hwparams.rate = strtoul(optarg, &eptr, 0);
-			if (*eptr != '\0')
-				bad_option("Sample Rate");
-			break;
-		case 'c':
-			hwparams.channels = strtoul(optarg, &eptr, 0);
-			if (*eptr != '\0')
-				bad_option("Channel Count");
-			break;
-		case 'b':
-			hwparams.buffer_frames = strtoul(optarg, &eptr, 0);
-			if (*eptr != '\0')
-				bad_option("H/W Buffer Size");
-			break;
-		case 'p':
-			hwparams.period_frames = strtoul(optarg, &eptr, 0);
-			if (*eptr != '\0')
-				bad_option("Period Size");
-			break;
-		case 'v':
-			verbose = 1;
-			break;
-		case 'f':
-			if (!(raw_capture_data_file = strdup(optarg))) {
-				prerr("strdup(3)\n");
-				exit(EXIT_FAILURE);
-			}
-			break;
-		case 'o':
-			for (format = 0; format < SND_PCM_FORMAT_LAST; format++) {
-				const char *format_name =
-				    snd_pcm_format_name(format);
+	p->phase = phase;
+	p->pending = p->workers;
+	for (i = 0; i < n; i++) {
+		__atomic_store_n(&p->q[i].next, i * ntasks / n, __ATOMIC_RELAXED);
+		p->q[i].end = (i + 1) * ntasks / n;
+	}
+	/* pairs with the worker's "sleeping" store then "go" load */
+	for (i = 1; i < n; i++) {
+		__atomic_store_n(&p->q[i].go, gen, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&p->q[i].sleeping, __ATOMIC_SEQ_CST))
+			syscall(SYS_futex, &p->q[i].go, FUTEX_WAKE_PRIVATE, 1,
+				NULL, NULL, 0);
+	}
 
-				if (format_name)
-					if (!strcasecmp(format_name, optarg))
-						goto get_format;
-			}
-			usage( );
+	pool_work(d, 0);
 
-get_format:
-			if (format == SND_PCM_FORMAT_LAST)
-				format = SND_PCM_FORMAT_S16;
+	/* join: spin, then sleep, so that a worker sharing this cpu at a
+	 * lower priority still gets to finish */
+	for (i = 0; i < NE_POOL_SPIN; i++) {
+		if (!__atomic_load_n(&p->pending, __ATOMIC_ACQUIRE))
+			return;
+		cpu_relax();
+	}
+	__atomic_store_n(&p->joining, 1, __ATOMIC_SEQ_CST);
+	while ((i = __atomic_load_n(&p->pending, __ATOMIC_SEQ_CST)))
+		syscall(SYS_futex, &p->pending, FUTEX_WAIT_PRIVATE, i,
+			NULL, NULL, 0);
+	__atomic_store_n(&p->joining, 0, __ATOMIC_RELAXED);
+}
 
-			if(snd_pcm_format_unsigned(format)){
-				prerr("Unsigned formats not supported\n");
-				exit(EXIT_FAILURE);
-			}
+static void *pool_thread(void *arg)
+{
+	struct ne_pool_worker *w = arg;
+	struct ne_capture_dev *d = w->d;
+	struct ne_pool *p = &d->pool;
+	struct ne_pool_queue *q = &p->q[w->id];
+	const struct ne_rt_role *role = &rt_roles[NE_ROLE_DSP];
+	uint32_t gen = 0, go;
+	int spin;
 
-			if(format == SND_PCM_FORMAT_FLOAT_LE ||
-			   format == SND_PCM_FORMAT_FLOAT_BE){
-				prerr("FLOAT formats unsupported %s\n", optarg);
-				exit(EXIT_FAILURE);
-			}
+	if (go_rt_thread(NE_ROLE_DSP, role->ncpus ?
+			 role_cpu(role, d->index * dsp_threads + w->id - 1) : -1))
+		prwarn("WARNING: \"%s\" dsp worker %d failed to go firm "
+		       "realtime!\n", d->device, w->id);
 
-			if (!snd_pcm_format_linear(format)){
-				prerr("Invalid non-linear format %s\n",
-				       optarg);
-				exit(EXIT_FAILURE);
-			}
-			hwparams.format = format;
+	for (;;) {
+		/* phases of one period follow each other closely: spin,
+		 * then sleep until the next period */
+		for (spin = 0; spin < NE_POOL_SPIN; spin++) {
+			go = __atomic_load_n(&q->go, __ATOMIC_ACQUIRE);
+			if (go != gen)
+				break;
+			cpu_relax();
+		}
+		if (go == gen) {
+			__atomic_store_n(&q->sleeping, 1, __ATOMIC_SEQ_CST);
+			while ((go = __atomic_load_n(&q->go, __ATOMIC_SEQ_CST))
+			       == gen)
+				syscall(SYS_futex, &q->go, FUTEX_WAIT_PRIVATE,
+					gen, NULL, NULL, 0);
+			__atomic_store_n(&q->sleeping, 0, __ATOMIC_RELAXED);
+		}
+		if (__atomic_load_n(&p->quit, __ATOMIC_ACQUIRE))
 			break;
+		gen = go;
+		pool_work(d, w->id);
+		if (!__atomic_sub_fetch(&p->pending, 1, __ATOMIC_SEQ_CST)
+		    && __atomic_load_n(&p->joining, __ATOMIC_SEQ_CST))
+			syscall(SYS_futex, &p->pending, FUTEX_WAKE_PRIVATE, 1,
+				NULL, NULL, 0);
+	}
+	return NULL;
+}
 
-		case 'h':
-		default:
-			usage( );
+/* a worker that fails to start leaves its share to the others */
+static void pool_start(struct ne_capture_dev *d)
+{
+	struct ne_pool *p = &d->pool;
+	struct ne_pool_worker *w;
+	int err;
+
+	while (p->workers < dsp_threads) {
+		w = &p->worker[p->workers];
+		w->d = d;
+		w->id = p->workers + 1;
+		if ((err = pthread_create(&w->thread, NULL, pool_thread, w))) {
+			prerr("pthread_create(3): %s\n", strerror(err));
+			break;
 		}
+		p->workers++;
 	}
 }
 
-/* dump PCM Plugin chain of software conversions to stdout */
-static int do_snd_pcm_dump(void)
+static void pool_stop(struct ne_capture_dev *d)
 {
-	snd_output_t *output = NULL;
-	int err = -1;
+	struct ne_pool *p = &d->pool;
+	int i;
 
-	err = snd_output_stdio_attach(&output, stdout, 0);
-	if (err < 0) {
-		prerr("%s\n", snd_strerror(err));
-		goto exit;
+	__atomic_store_n(&p->quit, 1, __ATOMIC_RELEASE);
+	for (i = 1; i <= p->workers; i++) {
+		__atomic_store_n(&p->q[i].go, p->gen + 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &p->q[i].go, FUTEX_WAKE_PRIVATE, 1,
+			NULL, NULL, 0);
 	}
+	for (i = 0; i < p->workers; i++)
+		pthread_join(p->worker[i].thread, NULL);
+	p->workers = 0;
+}
 
-	snd_pcm_dump(handle, output);
-	printf("\n");
+/* end of the period's publishing, and its capture to publish latency */
+static inline void probe_publish(struct ne_capture_dev *d)
+{
+	int64_t lap = stage_lap(d, &d->stage_ns);
 
-	err = 0;
-exit:
-	return err;
+	NE_PROBE(publish, d->index, d->period_count, lap,
+		 d->tracing ? d->stage_ns - d->capture_tstamp_ns : 0);
+	(void)lap;
 }
 
-#define __print_once_snd_pcm_state( ) \
-	do { \
-		static int first = 1; \
-		if (first) do_snd_pcm_state( ); \
-		first = 0; \
-	} while (0)
+/* perform pcm capture and fft processing of one device's audio stream */
+static void *capture_thread(void *arg)
+{
+	struct ne_capture_dev *d = arg;
+	struct ne_swap *sw;
+	struct ne_tuning *tn;
+	unsigned int ch;
+
+	/* going firm realtime */
+	if (go_rt_thread(NE_ROLE_CAPTURE, d->cpu))
+		prwarn("WARNING: \"%s\" failed to go firm realtime!\n",
+		       d->device);
+	pool_start(d);
+
+	while (!done) {
+
+		/* "--control": a new analysis, or a stop while the device
+		 * is reopened, once a batch is through */
+		if (d->batch_next + 1 >= d->batch) {
+			if ((sw = __atomic_load_n(&d->next, __ATOMIC_ACQUIRE))) {
+				analysis_swap(d, sw);
+				__atomic_store_n(&d->next, NULL,
+						 __ATOMIC_RELEASE);
+			}
+			if (__atomic_load_n(&d->park, __ATOMIC_ACQUIRE)) {
+				capture_park(d);
+				continue;
+			}
+		}
+		/* and new ballistics or window, from the next period on */
+		if ((tn = __atomic_load_n(&d->an->retune, __ATOMIC_ACQUIRE))) {
+			d->an->tune = tn;
+			__atomic_store_n(&d->an->retune, NULL,
+					 __ATOMIC_RELEASE);
+		}
+		if (do_capture(d)) {
+			printf("\n" "End of \"%s\":" "\n%*llu periods"
+			       "\n", d->device, 30,
+			       (unsigned long long)d->period_count);
+			done = 1;
+			break;
+		}
+		__print_once_snd_pcm_state(d);
+		if (d->pool.workers) {
+			pool_run(d, NE_POOL_ANALYZE);
+			stage_lap(d, &d->stage_ns);
+			pool_run(d, NE_POOL_BALLISTICS);
+		} else {
+			for (ch = 0; ch < d->an->analyze_channels;)
+				ch += analyze_channel(d, &d->an->scratch[0], ch);
+			stage_lap(d, &d->stage_ns);
+			do_ballistics(d, 0,
+				      d->an->analyze_channels * d->an->nbands);
+		}
+		NE_PROBE(bands, d->index, d->period_count,
+			 stage_lap(d, &d->stage_ns));
+		if (!publish_fold(d))
+			continue;
+		bands_publish(d);
+		spectrum_commit(d);
+		fanout_publish(d);
+		probe_publish(d);
+	}
+	pool_stop(d);
+	if (d->batches)
+		prinfo("\"%s\" caught up %llu times, %llu periods not "
+		       "published\n", d->device, (unsigned long long)d->batches,
+		       (unsigned long long)d->batch_skipped);
+	if (gate)
+		prinfo("\"%s\" gate closed %llu times, %llu of %llu channel "
+		       "periods not analyzed\n", d->device,
+		       (unsigned long long)d->gate_closes,
+		       (unsigned long long)d->gate_skipped,
+		       (unsigned long long)d->period_count *
+		       d->an->analyze_channels);
+	return NULL;
+}
 
-static void do_snd_pcm_state(void)
+/* once every device has started, show how their starts line up */
+static void report_alignment(void)
 {
-	if (!verbose)
-		printf("%*s: %u\n", 30, "PCM Stream State",
-		       snd_pcm_state(handle));
+	static int reported = 0;
+	int i;
+
+	if (reported || ndevs < 2)
+		return;
+	for (i = 0; i < ndevs; i++)
+		if (!__atomic_load_n(&devs[i].trigger_ns, __ATOMIC_ACQUIRE))
+			return;
+
+	printf("\n" "Device start alignment (relative to \"%s\"):\n",
+	       devs[0].device);
+	for (i = 1; i < ndevs; i++)
+		printf("%*s: %+.3f ms\n", 30, devs[i].device,
+		       (devs[i].trigger_ns - devs[0].trigger_ns) / 1e6);
+	reported = 1;
 }
 
-static int done = 0;
-static void sighandler(int sig)
+/*
+ * "--bench": run the float fft and the q15 engine over the same
+ * synthetic S16 periods (tones at several levels plus noise), each from
+ * interleaved samples to band levels, and compare time and levels.
+ */
+static int bench(void)
 {
-	/* printf async-unsafe even with sigaction? */
-	fprintf(stderr, "%s:%d:: Received signal %d\n", __func__, __LINE__, sig);
-	done = 1;
+	struct ne_capture_dev *d = &devs[0];
+	struct ne_analysis *an;
+	int i, j, e, n, chnls;
+	int16_t *pcm;
+	float *ref;
+	double t[2], diff, diff_max = 0.0, diff_sum = 0.0;
+	struct timespec t0, t1;
+	static const float tone_hz[] = { 50.0f, 440.0f, 3000.0f, 9000.0f };
+	static const float tone_db[] = { -6.0f, -20.0f, -40.0f, -60.0f };
+
+	d->device = "bench";
+	d->hwparams = hwparams;
+	d->hwparams.format = SND_PCM_FORMAT_S16;
+	n = d->hwparams.period_frames;
+	chnls = d->hwparams.channels;
+	if (n < 16 || n > 4096 || (n & (n - 1))) {
+		prerr("the q15 engine needs a power of 2 period (16..4096)\n");
+		return -1;
+	}
+	if (!ntones && fband_init(nbands))
+		return -1;
+	if (!(an = d->an = calloc(1, sizeof(*an)))) {
+		prerr("calloc(3) failed!\n");
+		return -1;
+	}
+	an->nbands = nbands;
+	an->fband_hz = fband_hz;
+	an->analyze_channels = analyze_channels;
+	an->rate = d->hwparams.rate;
+	an->n_points = an->fresh = an->fresh_max = n;
+	an->engine = NE_ENGINE_Q15;
+	kernels_init(d);
+	if (arena_init(d))
+		return -1;
+	if (!(ref = calloc(an->analyze_channels * an->nbands, sizeof(float))))
+		return -1;
+
+	pcm = (int16_t *)an->audiobuf;
+	srand(1);
+	for (i = 0; i < n; i++)
+		for (j = 0; j < chnls; j++) {
+			double v = (rand() % 17) - 8;
+			for (e = 0; e < 4; e++)
+				v += 32767.0 * powf(10.0f, tone_db[e] / 20.0f) *
+				    sin(2.0 * M_PI * tone_hz[e] * (j + 1) * i /
+					d->hwparams.rate);
+			pcm[i * chnls + j] = lrint(v > 32767.0 ? 32767.0 : v);
+		}
+
+	for (e = 0; e < 2; e++) {
+		an->engine = e ? NE_ENGINE_Q15 : NE_ENGINE_FFT;
+		if (e)
+			q15_init(d);
+		else if (fft_init(d))
+			return -1;
+		window_init(d, an->tune);
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (i = 0; i < bench_periods; i++) {
+			if (e)
+				q15_deinterleave(d);
+			else
+				deinterleave(d);
+			for (j = 0; j < (int)an->analyze_channels;)
+				j += e ? do_q15(d, &an->scratch[0], j) :
+				    do_fft(d, &an->scratch[0], j);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		t[e] = ((t1.tv_sec - t0.tv_sec) * 1e9 +
+			(t1.tv_nsec - t0.tv_nsec)) / 1e3 / bench_periods;
+		if (!e)
+			memcpy(ref, an->band_level,
+			       an->analyze_channels * an->nbands * sizeof(float));
+	}
+	for (i = 0; i < (int)an->analyze_channels * an->nbands; i++) {
+		diff = fabs(an->band_level[i] - ref[i]);
+		diff_max = diff > diff_max ? diff : diff_max;
+		diff_sum += diff;
+	}
+
+	printf("\n" "Benchmark (%d periods of %d frames, %u channels, "
+	       "%d bands):" "\n%*.2f us/period (fft)"
+	       "\n%*.2f us/period (q15, %.2fx)"
+	       "\n%*.3f max, %.3f mean |q15 - fft| band level"
+	       "\n", bench_periods, n, an->analyze_channels, an->nbands,
+	       30, t[0], 30, t[1], t[0] / t[1], 30, diff_max,
+	       diff_sum / (an->analyze_channels * an->nbands));
+	free(ref);
+	return 0;
 }
 
 int main(int argc, char *argv[])
 {
-	int err = -1, filesize;
+	int i, err = -1, started = 0;
 	struct sigaction sa;
-	unsigned int channels;
-	snd_pcm_uframes_t period_size;
-	snd_pcm_format_t format;
+	long ncpus;
+	struct timespec tick = {.tv_sec = 0,.tv_nsec = 100 * 1000 * 1000 };
 
 	if (!(prog = strdup(argv[0]))) {
 		prerr("strdup(3)\n");
 		exit(EXIT_FAILURE);
 	}
 	do_getopt_long(argc, argv);
-	format = hwparams.format;
-	channels = hwparams.channels;
-	period_size = hwparams.period_frames;
-
-	printf("Capture device is: \"%s\"\n", device);
-
-	/* open device */
-	if ((err = snd_pcm_open(&handle, device, stream, 0)) < 0) {
-		prerr("pcm open error (%s)\n", snd_strerror(err));
-		goto exit;
+	if (analyze_channels > hwparams.channels) {
+		prerr("can't analyze %u of %u channels\n", analyze_channels,
+		      hwparams.channels);
+		exit(EXIT_FAILURE);
 	}
+	if (bench_periods)
+		exit(bench() ? EXIT_FAILURE : EXIT_SUCCESS);
+	if (replay_file) {
+		if (ndevs == NE_MAX_DEVICES)
+			bad_option("Too many devices");
+		if (!(devs[ndevs].device = malloc(strlen(replay_file) + 8))) {
+			prerr("malloc(3) failed!\n");
+			exit(EXIT_FAILURE);
+		}
+		sprintf(devs[ndevs++].device, "replay:%s", replay_file);
+	}
+	if (!ndevs)
+		devs[ndevs++].device = "plughw:0,0";
 
-	do_snd_pcm_state();
-
-	/* setup hwparams */
-	if (set_hwparams())
-		goto exit;
-
-	do_snd_pcm_state();
-
-	/* alloc buffer to hold PCM period data */
-	if (alloc_period_pcm_buf())
-		goto exit;
-
-	/* alloc buffer to hold (deinterleaved) per-channel PCM data */
-	if (alloc_chnldata_buf())
-		goto exit;
-
-	/* shm ipc for "ne_glprog" */
-	filesize = sysconf(_SC_PAGE_SIZE);
-	ne_glprog_fband_data_map = 
-		shm_init(NE_GLPROG_FBAND_DATA_FILE, filesize);
-	if(!ne_glprog_fband_data_map)
-		goto exit;
-
-	/* shm ipc for a plotting program (e.g. "gnuplot(1)") */
-	if(raw_capture_data_file){
-		if((snd_pcm_format_physical_width(format) / 8) > (int)sizeof(int32_t)){
-			prerr("maximum supported sample format width for plotting is 32bits\n");
-			goto exit;
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	for (i = 0; i < ndevs; i++) {
+		devs[i].index = i;
+		devs[i].hwparams = hwparams;
+		if (rt_roles[NE_ROLE_CAPTURE].ncpus)
+			devs[i].cpu = role_cpu(&rt_roles[NE_ROLE_CAPTURE], i);
+		else
+			devs[i].cpu = i % (ncpus > 0 ? ncpus : 1);
+		if (!devs[i].ns) {
+			devs[i].ns = i ? malloc(16) : "";
+			if (!devs[i].ns) {
+				prerr("malloc(3) failed!\n");
+				exit(EXIT_FAILURE);
+			}
+			if (i)
+				snprintf(devs[i].ns, 16, "%d", i);
 		}
-	
-		filesize = period_size * channels * sizeof(int32_t);
-		raw_capture_data_map = 
-			shm_init(raw_capture_data_file, filesize);
-		if (!raw_capture_data_map)
-			goto exit;
 	}
 
-	/* initialize fft engine */
-	if (fft_init())
+	/* display bands shared by all devices */
+	if (!ntones && fband_init(nbands))
 		goto exit;
 
-	if (verbose > 0)
-		if (do_snd_pcm_dump())
+	for (i = 0; i < ndevs; i++)
+		if (dev_init(&devs[i]))
 			goto exit;
 
-#if 0
-	/* to perform function tracing with ftrace e.g. in order
-	 * to observe CPU affinity - you may include this function
-	 * call.
-	 * See "http://nairobi-embedded.org/ne_ftrace_rt_proc_affinity.html" 
-	 * for an example implementation.
-	 */
-	if (ftrace_startup())
+	if (link_devices) {
+		for (i = 0; i < ndevs; i++) {
+			if (!devs[i].handle) {
+				prerr("\"%s\": only ALSA devices can be linked\n",
+				      devs[i].device);
+				goto exit;
+			}
+		}
+		for (i = 1; i < ndevs; i++) {
+			if ((err = snd_pcm_link(devs[0].handle,
+						devs[i].handle)) < 0) {
+				prerr("can't link \"%s\" to \"%s\": %s\n",
+				      devs[i].device, devs[0].device,
+				      snd_strerror(err));
+				goto exit;
+			}
+		}
+	}
+
+	if (control_file && control_open())
 		goto exit;
-#endif
 
 	/* basic signal handling */
 	sigemptyset(&sa.sa_mask);
@@ -927,47 +5582,46 @@ int main(int argc, char *argv[])
 
 	/* going firm realtime */
 	printf("\n");
+	rt_check();
 	if (go_rt())
 		prwarn("WARNING: failed to go firm realtime!\n");
 
-	/* perform pcm capture and fft processing of audio stream */
-	while (!done) {
-
-		do_capture();
-		__print_once_snd_pcm_state( );
-		do_fft(0);
+	/* linked streams: one start triggers them all at once */
+	if (link_devices && ndevs > 1
+	    && (err = snd_pcm_start(devs[0].handle)) < 0) {
+		prerr("start error: %s\n", snd_strerror(err));
+		goto exit;
 	}
 
-	err = 0;
-exit:
-
-#if 0
-	/* See "http://nairobi-embedded.org/ne_ftrace_rt_proc_affinity.html" 
-	 * for an example implementation of the following function.
-	 */
-	ftrace_cleanup();
-#endif
-
-	/* for graceful termination */
-	snd_pcm_close(handle);
-
-	if (window)
-		free(window);
-
-	if (bin_band)
-		free(bin_band);
-
-	if (cplx)
-		free(cplx);
+	for (i = 0; i < ndevs; i++, started++) {
+		if ((err = pthread_create(&devs[i].thread, NULL,
+					  capture_thread, &devs[i]))) {
+			prerr("pthread_create(3): %s\n", strerror(err));
+			done = 1;
+			break;
+		}
+	}
 
-	if (real)
-		free(real);
+	/* housekeeping off the capture threads, set up after spawning them */
+	if (go_rt_thread(NE_ROLE_MAIN, -1))
+		prwarn("WARNING: main thread setup failed!\n");
+	while (!done) {
+		nanosleep(&tick, NULL);
+		report_alignment();
+		for (i = 0; i < ndevs; i++)
+			if (devs[i].an->fanout_map)
+				fanout_scan(&devs[i]);
+		if (control_file)
+			control_poll();
+	}
 
-	if (chnldata)
-		free(chnldata);
+	for (i = 0; i < started; i++)
+		pthread_join(devs[i].thread, NULL);
 
-	if (audiobuf)
-		free(audiobuf);
+	err = 0;
+exit:
+	for (i = 0; i < ndevs; i++)
+		dev_fini(&devs[i]);
 
 	return err;
 }
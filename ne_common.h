@@ -21,6 +21,8 @@
 #ifndef __NE_COMMON_H__
 #define __NE_COMMON_H__
 
+#include <stdint.h>
+
 #define prfmt(fmt) "%s:%d:: " fmt, __func__, __LINE__
 #define prinfo(fmt, ...) printf(prfmt(fmt), ##__VA_ARGS__)
 #define prerr(fmt, ...) fprintf(stderr, prfmt(fmt), ##__VA_ARGS__)
@@ -37,6 +39,88 @@ struct ne_glprog_fband_data{
 	float fband_magn;
 };
 
+/*
+ * The segment holds NE_GLPROG_FBANDS_MAX magnitudes followed by the band
+ * layout actually in use. Keeping the magnitudes at offset 0 means readers
+ * of the original 15-band page are unaffected.
+ *
+ * The layout can change at run time ("bands N" on the control FIFO). The
+ * producer makes gen odd while it rewrites the layout and even again when
+ * done; a reader takes a copy only while gen is even and unchanged across
+ * it, and re-lays its display out whenever gen moves on.
+ */
+#define NE_GLPROG_FBANDS_MAX 1024
+struct ne_glprog_fband_layout{
+	uint32_t nbands;
+	float fband_hz[NE_GLPROG_FBANDS_MAX];
+	uint32_t gen;
+};
+#define NE_GLPROG_FBAND_LAYOUT(map) \
+	((struct ne_glprog_fband_layout *) \
+	 ((struct ne_glprog_fband_data *)(map) + NE_GLPROG_FBANDS_MAX))
+#define NE_GLPROG_FBAND_DATA_SIZE \
+	(NE_GLPROG_FBANDS_MAX * sizeof(struct ne_glprog_fband_data) + \
+	 sizeof(struct ne_glprog_fband_layout))
+
+/*
+ * Spectrogram (waterfall) history in POSIX SHM: a ring of "rows" rows of
+ * "cols" display-calibrated values (0..250), one row written per period
+ * (per catch-up batch while the producer falls behind).
+ * The producer fills row (row_count % rows) and only then advances
+ * row_count, so a reader may upload rows [last seen, row_count) each frame.
+ * A reconfiguration that changes cols or row_ms replaces the segment under
+ * the same name and zeroes the old one's version; readers then re-attach.
+ */
+#define NE_GLPROG_WATERFALL_FILE "ne_glprog_waterfall_file"
+#define NE_GLPROG_WATERFALL_VERSION 1
+struct ne_glprog_waterfall{
+	uint32_t version;     /* NE_GLPROG_WATERFALL_VERSION */
+	uint32_t rows;        /* history depth */
+	uint32_t cols;        /* display bands or FFT bins per row */
+	uint32_t bins;        /* 1: cols are FFT bins 0..n/2, 0: display bands */
+	float hz_per_col;     /* bin spacing when "bins" is set */
+	float row_ms;         /* time between rows */
+	uint32_t row_count;   /* rows written so far */
+	float data[];         /* rows * cols */
+};
+#define NE_GLPROG_WATERFALL_SIZE(rows, cols) \
+	(sizeof(struct ne_glprog_waterfall) + (size_t)(rows) * (cols) * sizeof(float))
+
+/*
+ * Full-resolution FFT output in POSIX SHM, for analyzers other than
+ * `ne_glprog.c`. Values are of the FFT library's real type ("value_size"
+ * bytes) and laid out as data[2][channels][nvals]:
+ *
+ *	o NE_SPECTRUM_HALFCOMPLEX: the n values exactly as the FFT produced
+ *	  them, r0, r1, ..., r(n/2), i((n+1)/2-1), ..., i1
+ *	o NE_SPECTRUM_MAGN: the n/2+1 bin magnitudes, DC to Nyquist
+ *
+ * The two slots are double-buffered: the producer fills slot
+ * ((seq + 1) & 1) and then advances seq. A reader loads seq, copies slot
+ * (seq & 1) and must see seq unchanged afterwards; that gives it one
+ * period to take the copy.
+ */
+#define NE_ALSA_SPECTRUM_FILE "ne_alsa_spectrum_file"
+#define NE_ALSA_SPECTRUM_VERSION 1
+#define NE_SPECTRUM_HALFCOMPLEX 0
+#define NE_SPECTRUM_MAGN 1
+struct ne_alsa_spectrum{
+	uint32_t version;     /* NE_ALSA_SPECTRUM_VERSION */
+	uint32_t kind;        /* NE_SPECTRUM_* */
+	uint32_t value_size;  /* sizeof(float) or sizeof(double) */
+	uint32_t n_points;    /* FFT length */
+	uint32_t nvals;       /* values per channel */
+	uint32_t channels;
+	uint32_t rate;
+	uint32_t seq;         /* frames published */
+	uint64_t frame[2];    /* capture period index held in each slot */
+	int64_t tstamp_ns[2]; /* newest frame's capture time, CLOCK_MONOTONIC */
+	uint8_t data[];       /* 64-byte aligned */
+};
+#define NE_ALSA_SPECTRUM_SIZE(value_size, channels, nvals) \
+	(sizeof(struct ne_alsa_spectrum) + \
+	 2 * (size_t)(value_size) * (channels) * (nvals))
+
 /* 
  * `ne_glprog.c` is designed to display the audio spectrum of an audio 
  *  stream by either:
@@ -0,0 +1,191 @@
+/*
+ * file:  ne_fanout.h
+ * desc:  broadcast ring of analysis frames in POSIX SHM, shared by
+ *        `ne_alsa_capture.c` (the single writer) and any number of
+ *        readers (display, logger, alerting, ...)
+ *
+ * The writer never waits for anyone. It fills ring slot (head % slots),
+ * stamps the slot with its frame number and then advances head. Each
+ * reader claims one of NE_FANOUT_READERS registration slots and keeps
+ * its own cursor and counters there; a reader that falls more than a
+ * ring behind loses the overwritten frames, counts them as drops and
+ * resynchronizes. The writer periodically scans the registrations,
+ * reports readers whose lag crosses half the ring and reclaims slots of
+ * readers that died without detaching.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __NE_FANOUT_H__
+#define __NE_FANOUT_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NE_ALSA_FANOUT_FILE "ne_alsa_fanout_file"
+#define NE_ALSA_FANOUT_VERSION 3
+#define NE_FANOUT_READERS 16
+#define NE_FANOUT_ALIGN 64
+
+/* one per reader, on its own cache line */
+struct ne_fanout_reader{
+	uint32_t pid;         /* 0: free, claimed by the reader with a CAS */
+	uint32_t slow;        /* set/cleared by the writer's lag scan */
+	uint64_t cursor;      /* next frame number to read (reader) */
+	uint64_t frames;      /* frames read (reader) */
+	uint64_t drops;       /* frames overwritten before being read (reader) */
+	uint64_t lag_max;     /* worst lag seen by the writer's scan (writer) */
+	uint8_t pad[24];
+} __attribute__((aligned(NE_FANOUT_ALIGN)));
+
+/* frame flags: published after catching up on a capture backlog; every
+ * channel below the "--gate" level, bands decaying */
+#define NE_FANOUT_CAUGHT_UP 0x1
+#define NE_FANOUT_GATED 0x2
+
+/* per channel features of a frame, "--features" */
+struct ne_fanout_features{
+	float peak;           /* time domain, fraction of full scale */
+	float rms;            /* likewise */
+	float centroid_hz;    /* power weighted mean frequency */
+	float rolloff_hz;     /* below which 85% of the power lies */
+	float flux;           /* rise of the power spectrum, normalized */
+	float onset;          /* 1.0 when flux jumps above its running mean */
+};
+
+/* header of each ring slot, followed by bands[channels][nbands], then
+ * features[channels] if the header's "features" is set */
+struct ne_fanout_frame{
+	uint64_t seq;         /* frame number + 1 when valid, 0 while written */
+	uint64_t period;      /* capture period index */
+	int64_t tstamp_ns;    /* newest frame's capture time, CLOCK_MONOTONIC */
+	uint32_t flags;       /* NE_FANOUT_CAUGHT_UP, NE_FANOUT_GATED */
+	uint32_t periods;     /* capture periods aggregated into the bands */
+	uint64_t gated;       /* bit c: channel c (< 64) gated, not analyzed */
+	float bands[];
+};
+
+struct ne_alsa_fanout{
+	uint32_t version;     /* NE_ALSA_FANOUT_VERSION */
+	uint32_t slots;       /* ring depth in frames */
+	uint32_t slot_size;   /* bytes per slot, NE_FANOUT_ALIGN multiple */
+	uint32_t channels;
+	uint32_t nbands;
+	uint32_t features;    /* 1: frames carry struct ne_fanout_features */
+	uint64_t head;        /* frames published */
+	int64_t trigger_ns;   /* capture start, CLOCK_MONOTONIC */
+	uint64_t gate_closes; /* times a channel's "--gate" closed */
+	uint64_t gated;       /* channel periods not analyzed for it */
+	struct ne_fanout_reader reader[NE_FANOUT_READERS];
+	/* ring slots follow */
+} __attribute__((aligned(NE_FANOUT_ALIGN)));
+
+#define NE_FANOUT_SLOT_SIZE(channels, nbands, features) \
+	((sizeof(struct ne_fanout_frame) + \
+	  (size_t)(channels) * (nbands) * sizeof(float) + \
+	  ((features) ? (size_t)(channels) * \
+	   sizeof(struct ne_fanout_features) : 0) + \
+	  NE_FANOUT_ALIGN - 1) & ~(size_t)(NE_FANOUT_ALIGN - 1))
+#define NE_ALSA_FANOUT_SIZE(slots, slot_size) \
+	(sizeof(struct ne_alsa_fanout) + (size_t)(slots) * (slot_size))
+
+static inline struct ne_fanout_frame *
+ne_fanout_slot(struct ne_alsa_fanout *fo, uint64_t frame)
+{
+	return (struct ne_fanout_frame *)((uint8_t *)(fo + 1) +
+		(size_t)(frame % fo->slots) * fo->slot_size);
+}
+
+/* features[channels] of a frame, or NULL without "--features" */
+static inline struct ne_fanout_features *
+ne_fanout_frame_features(const struct ne_alsa_fanout *fo,
+			 struct ne_fanout_frame *frame)
+{
+	if (!fo->features)
+		return NULL;
+	return (struct ne_fanout_features *)(frame->bands +
+		(size_t)fo->channels * fo->nbands);
+}
+
+/* ===== reader side ===== */
+
+/* claim a registration slot, starting at the newest frame */
+static inline struct ne_fanout_reader *
+ne_fanout_attach(struct ne_alsa_fanout *fo)
+{
+	int i;
+	uint32_t free_pid;
+	struct ne_fanout_reader *rd;
+
+	for (i = 0; i < NE_FANOUT_READERS; i++) {
+		rd = &fo->reader[i];
+		free_pid = 0;
+		if (!__atomic_compare_exchange_n(&rd->pid, &free_pid,
+						 (uint32_t)getpid(), 0,
+						 __ATOMIC_ACQ_REL,
+						 __ATOMIC_RELAXED))
+			continue;
+		rd->frames = rd->drops = rd->lag_max = 0;
+		rd->slow = 0;
+		__atomic_store_n(&rd->cursor,
+				 __atomic_load_n(&fo->head, __ATOMIC_ACQUIRE),
+				 __ATOMIC_RELEASE);
+		return rd;
+	}
+	return NULL;
+}
+
+static inline void ne_fanout_detach(struct ne_fanout_reader *rd)
+{
+	__atomic_store_n(&rd->pid, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copy the next unread frame (fo->slot_size bytes) to "buf".
+ * Returns 1 if a frame was copied, 0 if there is nothing new.
+ */
+static inline int ne_fanout_read(struct ne_alsa_fanout *fo,
+				 struct ne_fanout_reader *rd, void *buf)
+{
+	uint64_t head, cursor = rd->cursor, seq;
+	struct ne_fanout_frame *slot;
+
+	for (;;) {
+		head = __atomic_load_n(&fo->head, __ATOMIC_ACQUIRE);
+		if (cursor >= head)
+			return 0;
+
+		/* lapped: skip to the oldest frame still in the ring */
+		if (head - cursor > fo->slots) {
+			rd->drops += head - cursor - fo->slots;
+			cursor = head - fo->slots;
+		}
+
+		slot = ne_fanout_slot(fo, cursor);
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == cursor + 1) {
+			memcpy(buf, slot, fo->slot_size);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+				break;
+		}
+		/* overwritten under us */
+		rd->drops++;
+		cursor++;
+	}
+
+	rd->frames++;
+	__atomic_store_n(&rd->cursor, cursor + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+#endif /* __NE_FANOUT_H__ */
@@ -33,6 +33,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#define GL_GLEXT_PROTOTYPES
 #include <GL/glut.h>
 #include <string.h>
 #include <errno.h>
@@ -41,9 +42,16 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <getopt.h>
 
 #include "ne_common.h"
 static struct ne_glprog_fband_data *fband_data_map;
+/* band layout published by the producer (or the legacy default) */
+static int nbands = NE_GLPROG_FBANDS;
+static float *fband_hz = ne_glprog_fband;
+static struct ne_glprog_fband_layout *fband_layout;
+static float fband_layout_hz[NE_GLPROG_FBANDS_MAX];
+static uint32_t fband_layout_gen = 1; /* odd: none taken yet */
 
 /* glut window width and height */
 #define WINWIDTH 570
@@ -80,18 +88,262 @@ void resetPerspectiveProjection() {
 }
 
 /* ======= Frequency-band bars rendering routine ====== */
+/*
+ * All bars live in one vertex array of GL_QUADS, four (x,y) vertices per
+ * band. The x coordinates are laid out once per reshape; each frame only
+ * rewrites the top edges from shm and re-uploads the array in a single
+ * call, so the whole spectrum is one draw regardless of the band count.
+ * VBOs are used when the GL (e.g. Mesa llvmpipe) offers them, with plain
+ * client-side arrays as the fallback.
+ */
 #define BARWIDTH 30
 #define BARSPACING 7
 #define X_BAROFFSET (BARSPACING + BARWIDTH)
 #define Y_BAROFFSET 30
+static GLfloat *bar_verts;
+static GLuint bar_vbo;
+static int use_vbo;
+
+static void layout_bands(void)
+{
+	int i;
+	float pitch = (float)win_x / nbands;
+	float space = pitch * BARSPACING / X_BAROFFSET;
+	GLfloat *v;
+
+	for(i = 0; i < nbands; i++){
+		v = bar_verts + (i * 8);
+		v[0] = v[6] = (i * pitch) + space;
+		v[2] = v[4] = (i + 1) * pitch;
+		v[1] = v[3] = v[5] = v[7] = Y_BAROFFSET;
+	}
+}
+
 void draw_bands(void) {
 	int i;
+	GLfloat top, *v;
+	size_t size = nbands * 8 * sizeof(GLfloat);
+
+	for(i = 0; i < nbands; i++){
+		v = bar_verts + (i * 8);
+		top = fband_data_map[i].fband_magn + Y_BAROFFSET;
+		v[5] = v[7] = top;
+	}
 
 	glColor3f(.4f, .4f, .4f);
-	for(i = 0; i < NE_GLPROG_FBANDS; i++)
-		glRectf(BARSPACING + (i * X_BAROFFSET), Y_BAROFFSET, 
-						X_BAROFFSET + (i * X_BAROFFSET), 
-						fband_data_map[i].fband_magn + Y_BAROFFSET);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	if(use_vbo){
+		glBindBuffer(GL_ARRAY_BUFFER, bar_vbo);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, size, bar_verts);
+		glVertexPointer(2, GL_FLOAT, 0, NULL);
+	}
+	else
+		glVertexPointer(2, GL_FLOAT, 0, bar_verts);
+	glDrawArrays(GL_QUADS, 0, nbands * 4);
+	if(use_vbo)
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+/* (re)size the vertex array and its VBO for the current band count */
+static int bands_gl_alloc(void)
+{
+	GLfloat *v;
+
+	v = realloc(bar_verts, nbands * 8 * sizeof(GLfloat));
+	if(!v){
+		prerr("realloc(3) failed!\n");
+		return -1;
+	}
+	bar_verts = v;
+	layout_bands();
+
+	if(use_vbo){
+		glBindBuffer(GL_ARRAY_BUFFER, bar_vbo);
+		glBufferData(GL_ARRAY_BUFFER, nbands * 8 * sizeof(GLfloat),
+		             bar_verts, GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	return 0;
+}
+
+static int bands_gl_init(void)
+{
+	const char *version = (const char *)glGetString(GL_VERSION);
+	int major = 1, minor = 0;
+
+	if(version)
+		sscanf(version, "%d.%d", &major, &minor);
+	use_vbo = major > 1 || (major == 1 && minor >= 5);
+	if(use_vbo)
+		glGenBuffers(1, &bar_vbo);
+	return bands_gl_alloc();
+}
+
+/* ======= Waterfall (spectrogram) rendering routine ====== */
+/*
+ * The history ring in shm maps 1:1 onto a rows x cols RGB texture with
+ * GL_REPEAT along t. Each frame only the rows written since the previous
+ * frame are colour-mapped and sent with glTexSubImage2D; scrolling is
+ * done by offsetting the texture coordinates by the producer's cursor.
+ */
+#define Y_WFTOP 30
+static void *shm_init(const char *const shm_filename, size_t *filesize);
+static struct ne_glprog_waterfall *waterfall_map;
+static size_t waterfall_size;
+static int waterfall_view;
+static GLuint waterfall_tex;
+static uint32_t waterfall_seen;
+static GLubyte *waterfall_rgb;
+static GLubyte palette[256][3];
+
+static void palette_init(void)
+{
+	int i;
+	float v;
+
+	/* black -> blue -> red -> yellow -> white */
+	for(i = 0; i < 256; i++){
+		v = i / 255.0f;
+		palette[i][0] = 255 * (v < .33f ? 0 : v < .66f ? (v - .33f) * 3 : 1);
+		palette[i][1] = 255 * (v < .66f ? 0 : v < .9f ? (v - .66f) / .24f : 1);
+		palette[i][2] = 255 * (v < .33f ? v * 3 : v < .66f ? (.66f - v) * 3 :
+		                       v < .9f ? 0 : (v - .9f) * 10);
+	}
+}
+
+static void waterfall_upload(uint32_t first, uint32_t count)
+{
+	uint32_t i, cols = waterfall_map->cols;
+	const float *src = waterfall_map->data + (size_t)first * cols;
+	GLubyte *dst = waterfall_rgb;
+	int idx;
+
+	for(i = 0; i < count * cols; i++, dst += 3){
+		idx = (int)(src[i] * 255.0f / 250.0f);
+		idx = idx < 0 ? 0 : idx > 255 ? 255 : idx;
+		memcpy(dst, palette[idx], 3);
+	}
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, cols, count,
+	                GL_RGB, GL_UNSIGNED_BYTE, waterfall_rgb);
+}
+
+static void waterfall_update(void)
+{
+	uint32_t rows = waterfall_map->rows;
+	uint32_t count, fresh, first, span;
+
+	count = __atomic_load_n(&waterfall_map->row_count, __ATOMIC_ACQUIRE);
+	fresh = count - waterfall_seen;
+	if(!fresh)
+		return;
+	/* fell a whole ring behind, or the producer restarted */
+	if(fresh > rows)
+		fresh = rows;
+
+	first = (count - fresh) % rows;
+	span = fresh < rows - first ? fresh : rows - first;
+	waterfall_upload(first, span);
+	if(fresh > span)
+		waterfall_upload(0, fresh - span);
+	waterfall_seen = count;
+}
+
+void draw_waterfall(void) {
+	float top;
+
+	glBindTexture(GL_TEXTURE_2D, waterfall_tex);
+	waterfall_update();
+	top = (float)(waterfall_seen % waterfall_map->rows) / waterfall_map->rows;
+
+	/* newest row at the top */
+	glEnable(GL_TEXTURE_2D);
+	glColor3f(1.0f, 1.0f, 1.0f);
+	glBegin(GL_QUADS);
+	glTexCoord2f(0.0f, top - 1.0f);	glVertex2f(0, Y_BAROFFSET);
+	glTexCoord2f(1.0f, top - 1.0f);	glVertex2f(win_x, Y_BAROFFSET);
+	glTexCoord2f(1.0f, top);		glVertex2f(win_x, win_y - Y_WFTOP);
+	glTexCoord2f(0.0f, top);		glVertex2f(0, win_y - Y_WFTOP);
+	glEnd();
+	glDisable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+static int waterfall_gl_init(void)
+{
+	size_t filesize = 0;
+	GLint max_size;
+	struct ne_glprog_waterfall *wf;
+
+	wf = shm_init(NE_GLPROG_WATERFALL_FILE, &filesize);
+	if(!wf)
+		return -1;
+	if(filesize < sizeof(*wf) || !wf->rows ||
+	   __atomic_load_n(&wf->version, __ATOMIC_ACQUIRE) !=
+	   NE_GLPROG_WATERFALL_VERSION ||
+	   filesize < NE_GLPROG_WATERFALL_SIZE(wf->rows, wf->cols)){
+		prerr("\"%s\" is not initialized\n", NE_GLPROG_WATERFALL_FILE);
+		goto err;
+	}
+	if(!wf->bins && wf->cols != (uint32_t)nbands){
+		prerr("waterfall has %u bands, display has %d\n", wf->cols, nbands);
+		goto err;
+	}
+
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	if(wf->cols > (uint32_t)max_size || wf->rows > (uint32_t)max_size){
+		prerr("waterfall %ux%u exceeds GL_MAX_TEXTURE_SIZE %d\n",
+		      wf->cols, wf->rows, max_size);
+		goto err;
+	}
+
+	waterfall_rgb = calloc((size_t)wf->rows * wf->cols, 3);
+	if(!waterfall_rgb){
+		prerr("calloc(3) failed!\n");
+		goto err;
+	}
+	palette_init();
+
+	glGenTextures(1, &waterfall_tex);
+	glBindTexture(GL_TEXTURE_2D, waterfall_tex);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, wf->cols, wf->rows, 0,
+	             GL_RGB, GL_UNSIGNED_BYTE, waterfall_rgb);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	waterfall_map = wf;
+	waterfall_size = filesize;
+	/* upload the whole ring on first use */
+	waterfall_seen = wf->row_count - wf->rows - 1;
+	return 0;
+err:
+	munmap(wf, filesize);
+	return -1;
+}
+
+/*
+ * The producer retired our segment (its shape changed): drop it and
+ * attach to the one that replaced it, or fall back to the bands view.
+ */
+static int waterfall_check(void)
+{
+	if(!waterfall_map || __atomic_load_n(&waterfall_map->version,
+	                                     __ATOMIC_ACQUIRE))
+		return 0;
+
+	glDeleteTextures(1, &waterfall_tex);
+	free(waterfall_rgb);
+	waterfall_rgb = NULL;
+	munmap(waterfall_map, waterfall_size);
+	waterfall_map = NULL;
+	if(waterfall_view && waterfall_gl_init())
+		waterfall_view = 0;
+	return 1;
 }
 
 /* ======= Display engine ======= */
@@ -110,17 +362,86 @@ static void post_display ( void )
 	glutSwapBuffers ();
 }
 
+/*
+ * Text is baked into display lists: the band labels are rebuilt only on
+ * reshape and the FPS line only when its value changes (once a second).
+ */
 static int time, timebase = 0, frame = 0;
 #define SLEN 64
-static char s1[SLEN], s2[SLEN];
+static char s1[SLEN];
 #define FBSLEN 16
-static char fbands[NE_GLPROG_FBANDS][FBSLEN];
-static void display_func ( void )
+static char (*fbands)[FBSLEN];
+#define LABEL_CHARS 8 /* widest label is e.g. "19.9KHz " */
+#define CHAR_WIDTH 8  /* GLUT_BITMAP_8_BY_13 */
+static GLuint label_list, fps_list;
+
+static void build_label_list(void)
 {
-	int i;
+	int i, step;
+	float pitch = (float)win_x / nbands;
+	float khz;
+	char s2[SLEN];
 
+	/* skip labels which would overlap their neighbour on the same row */
+	step = (int)(LABEL_CHARS * CHAR_WIDTH / (2 * pitch)) + 1;
+
+	glNewList(label_list, GL_COMPILE);
+	renderBitmapString(30, 25, GLUT_BITMAP_8_BY_13, 
+										(char *) "Esc or 'q' to Quit, 'w' for waterfall");
+	if(waterfall_view && waterfall_map->bins){
+		/* linear frequency axis at quarters of the bin range */
+		for(i = 0; i <= 4; i++){
+			khz = i * (waterfall_map->cols - 1) * waterfall_map->hz_per_col /
+			      4000.0f;
+			snprintf(s2, SLEN, "%.1fKHz", khz);
+			renderBitmapString(i < 4 ? i * win_x / 4 : win_x - 
+			                   LABEL_CHARS * CHAR_WIDTH, win_y-5, 
+			                   GLUT_BITMAP_8_BY_13, s2);
+		}
+		glEndList();
+		return;
+	}
+	for(i = 0; i < nbands; i += step){
+		if((i / step) % 2)
+			renderBitmapString(pitch * i, win_y-20, 
+					               GLUT_BITMAP_8_BY_13, fbands[i]);
+		else
+			renderBitmapString(pitch * i, win_y-5, 
+					               GLUT_BITMAP_8_BY_13, fbands[i]);
+	}
+	glEndList();
+}
+
+static void build_fps_list(void)
+{
+	glNewList(fps_list, GL_COMPILE);
+	renderBitmapString(30, 10, GLUT_BITMAP_8_BY_13,s1);
+	glEndList();
+}
+
+static int misc_init(void);
+static int fband_layout_take(void);
+
+/* follow a band layout the producer changed at run time */
+static void fband_layout_check(void)
+{
+	if(!fband_layout_take())
+		return;
+	if(misc_init() || bands_gl_alloc())
+		exit(EXIT_FAILURE);
+	build_label_list();
+}
+
+static void display_func ( void )
+{
+	fband_layout_check();
+	if(waterfall_check())
+		build_label_list();
 	pre_display ();
-	draw_bands();
+	if(waterfall_view)
+		draw_waterfall();
+	else
+		draw_bands();
 	frame++;
 	time=glutGet(GLUT_ELAPSED_TIME);
 	if (time - timebase > 1000) {
@@ -128,24 +449,15 @@ static void display_func ( void )
 			frame*1000.0/(time-timebase));
 		timebase = time;		
 		frame = 0;
+		build_fps_list();
 	}
 
 	glColor3f(0.0f,1.0f,1.0f);
 	glPushMatrix();
 	glLoadIdentity();
 	setOrthographicProjection();
-	renderBitmapString(30, 10, GLUT_BITMAP_8_BY_13,s1);
-	renderBitmapString(30, 25, GLUT_BITMAP_8_BY_13, 
-										(char *) "Esc or 'q' to Quit");
-	for(i = 0; i < NE_GLPROG_FBANDS; i++){
-		snprintf(s2, SLEN, "%s", fbands[i]);
-		if(i % 2)
-			renderBitmapString(X_BAROFFSET * i, win_y-20, 
-					               GLUT_BITMAP_8_BY_13, s2);
-		else
-			renderBitmapString(X_BAROFFSET * i, win_y-5, 
-					               GLUT_BITMAP_8_BY_13, s2);
-	}
+	glCallList(fps_list);
+	glCallList(label_list);
 	glPopMatrix();
 	resetPerspectiveProjection();
 	post_display ();
@@ -167,6 +479,13 @@ static void key_func ( unsigned char key, int x, int y )
 		case 'Q':
 			exit (EXIT_SUCCESS);
 			break;			
+		case 'w':
+		case 'W':
+			if(!waterfall_map && waterfall_gl_init())
+				break;
+			waterfall_view = !waterfall_view;
+			build_label_list();
+			break;
 	}
 }
 
@@ -177,25 +496,74 @@ static void reshape_func ( int width, int height )
 
 	win_x = width;
 	win_y = height;
+	layout_bands();
+	build_label_list();
 }
 
 /* ======== Initialization Routines ======= */
 
-static void misc_init(void)
+static int misc_init(void)
 {
 	int i;
 	float val;
 
-	for(i = 0; i < NE_GLPROG_FBANDS; i++){
-		val = ne_glprog_fband[i]/1000.0f;
+	free(fbands);
+	fbands = calloc(nbands, FBSLEN);
+	if(!fbands){
+		prerr("calloc(3) failed!\n");
+		return -1;
+	}
+
+	for(i = 0; i < nbands; i++){
+		val = fband_hz[i]/1000.0f;
 		if((int)val == 0)
 			snprintf(fbands[i], FBSLEN, "%dHz", (int)(val * 1000));
 		else
 			snprintf(fbands[i], FBSLEN, "%.1fKHz", val);
 	}
+	return 0;
 }
 
-static void *shm_init(const char *const shm_filename)
+/*
+ * Take a copy of the producer's band layout if it published a new one;
+ * returns 1 when nbands/fband_hz changed.
+ */
+static int fband_layout_take(void)
+{
+	uint32_t gen, n;
+
+	if(!fband_layout)
+		return 0;
+	gen = __atomic_load_n(&fband_layout->gen, __ATOMIC_ACQUIRE);
+	if(gen == fband_layout_gen || (gen & 1))
+		return 0;
+
+	n = fband_layout->nbands;
+	if(n < 2 || n > NE_GLPROG_FBANDS_MAX)
+		return 0;
+	memcpy(fband_layout_hz, fband_layout->fband_hz, n * sizeof(float));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	/* rewritten under us: try again next frame */
+	if(__atomic_load_n(&fband_layout->gen, __ATOMIC_RELAXED) != gen)
+		return 0;
+
+	fband_layout_gen = gen;
+	nbands = n;
+	fband_hz = fband_layout_hz;
+	return 1;
+}
+
+/* pick up the producer's band layout, if it published one */
+static void fband_layout_init(size_t shm_filesize)
+{
+	if(shm_filesize < NE_GLPROG_FBAND_DATA_SIZE)
+		return;
+
+	fband_layout = NE_GLPROG_FBAND_LAYOUT(fband_data_map);
+	fband_layout_take();
+}
+
+static void *shm_init(const char *const shm_filename, size_t *filesize)
 {
 	int fd, ret = -1;
 	struct stat stat;
@@ -224,6 +592,7 @@ static void *shm_init(const char *const shm_filename)
 		map = NULL;
 		goto exit;
 	}
+	*filesize = shm_filesize;
 
 exit:
 	close(fd);
@@ -242,6 +611,17 @@ static void open_glut_window ( void )
 	glClear ( GL_COLOR_BUFFER_BIT );
 	glutSwapBuffers ();
 	pre_display ();
+	label_list = glGenLists(2);
+	fps_list = label_list + 1;
+	build_label_list();
+	build_fps_list();
+	if(bands_gl_init())
+		exit(EXIT_FAILURE);
+	if(waterfall_view){
+		if(waterfall_gl_init())
+			exit(EXIT_FAILURE);
+		build_label_list();
+	}
 	glutKeyboardFunc ( key_func );
 	glutReshapeFunc ( reshape_func );
 	glutIdleFunc ( idle_func );
@@ -250,12 +630,28 @@ static void open_glut_window ( void )
 
 int main(int argc, char **argv) 
 {
+	size_t filesize = 0;
+	int c;
+
 	glutInit(&argc, argv);
+	while((c = getopt(argc, argv, "wh")) >= 0){
+		switch(c){
+			case 'w':
+				/* start in waterfall view (needs "ne_alsa_capture -W") */
+				waterfall_view = 1;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-w]\n", argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
 	fband_data_map = (struct ne_glprog_fband_data *)
-		shm_init(NE_GLPROG_FBAND_DATA_FILE);
+		shm_init(NE_GLPROG_FBAND_DATA_FILE, &filesize);
 	if(!fband_data_map)
 		exit(EXIT_FAILURE);
-	misc_init();
+	fband_layout_init(filesize);
+	if(misc_init())
+		exit(EXIT_FAILURE);
 	open_glut_window();
 	glutMainLoop();
 	exit(EXIT_SUCCESS);
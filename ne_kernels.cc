@@ -0,0 +1,237 @@
+/*
+ * file:  ne_kernels.cc
+ * desc:  compile-time specialized DSP kernels for `ne_alsa_capture.c`
+ *
+ * Each kernel is a template on the parameters that are fixed for the
+ * life of a stream: sample layout, channel count, fft size, resampler
+ * length. The common
+ * configurations are instantiated below and selected once through the
+ * dispatch tables, so every loop the capture thread runs per period has
+ * constant bounds and strides the compiler can unroll and vectorize. A
+ * template argument of 0 is the generic (run time) instantiation used
+ * for anything else.
+ *
+ * Plain C linkage, no exceptions, no RTTI, no libstdc++.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stddef.h>
+#include "ne_kernels.h"
+
+/* one signed sample of "Width" bits in "Bytes" bytes, sign extended */
+template <int Bytes, int Width, bool BigEndian>
+static inline int32_t load_sample(const uint8_t *p)
+{
+	uint32_t u = 0;
+
+	for (int k = 0; k < Bytes; k++)
+		u |= (uint32_t)p[BigEndian ? Bytes - 1 - k : k] << 8 * k;
+	return (int32_t)(u << (32 - Width)) >> (32 - Width);
+}
+
+template <int Bytes, int Width, bool BigEndian, int Channels>
+static void deint(const void *src, float *dst, int frames, int channels,
+		  int32_t *raw0)
+{
+	const uint8_t *__restrict p = (const uint8_t *)src;
+	const int nch = Channels ? Channels : channels;
+	const size_t stride = (size_t)nch * Bytes;
+	int i, j;
+
+	for (j = 0; j < nch; j++, dst += frames)
+		for (i = 0; i < frames; i++)
+			dst[i] = load_sample<Bytes, Width, BigEndian>
+			    (p + i * stride + j * Bytes);
+
+	/* only dumping channel 0 raw pcm in shm for plotting program */
+	if (raw0)
+		for (i = 0; i < frames; i++)
+			raw0[i] = load_sample<Bytes, Width, BigEndian>
+			    (p + i * stride);
+}
+
+template <int N>
+static void window(const float *__restrict x, const double *__restrict w,
+		   ne_real *__restrict out, int n)
+{
+	const int len = N ? N : n;
+
+	for (int i = 0; i < len; i++)
+		out[i] = (double)x[i] * w[i];
+}
+
+template <int N>
+static void window2(const float *__restrict a, const float *__restrict b,
+		    const double *__restrict w, ne_real *__restrict z, int n)
+{
+	const int len = N ? N : n;
+
+	for (int i = 0; i < len; i++) {
+		z[2 * i] = (double)a[i] * w[i];
+		z[2 * i + 1] = (double)b[i] * w[i];
+	}
+}
+
+template <int N>
+static void power(const ne_real *__restrict X, ne_real *__restrict P, int n)
+{
+	const int len = N ? N : n;
+
+	for (int k = 1; k < len / 2; k++)
+		P[k] = X[k] * X[k] + X[len - k] * X[len - k];
+}
+
+template <int N>
+static void stats(const float *__restrict x, int n, float *peak, double *sumsq)
+{
+	const int len = N ? N : n;
+	float m = 0.0f, a;
+	double e = 0.0;
+
+	for (int i = 0; i < len; i++) {
+		a = x[i] < 0.0f ? -x[i] : x[i];
+		m = a > m ? a : m;
+		e += (double)x[i] * x[i];
+	}
+	*peak = m;
+	*sumsq = e;
+}
+
+/*
+ * One output per step of "up" phases over the input, "down" phases at a
+ * time. The dot product keeps eight partial sums, independent lanes the
+ * compiler can vectorize without reassociating float adds.
+ */
+template <int Taps>
+static int resample(const float *__restrict x, int n,
+		    const float *__restrict coef, int taps, int up, int down,
+		    int *pos, int *phase, float *__restrict out)
+{
+	const int len = Taps ? Taps : taps;
+	int i, k, m = 0, t = *pos, p = *phase;
+	float acc[8];
+
+	for (; t < n; m++) {
+		const float *c = coef + (size_t)p * len, *v = x + t;
+
+		for (k = 0; k < 8; k++)
+			acc[k] = 0.0f;
+		for (i = 0; i < len; i += 8)
+			for (k = 0; k < 8; k++)
+				acc[k] += c[i + k] * v[i + k];
+		out[m] = ((acc[0] + acc[4]) + (acc[1] + acc[5])) +
+		    ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+
+		p += down;
+		t += p / up;
+		p %= up;
+	}
+	*pos = t - n;
+	*phase = p;
+	return m;
+}
+
+/* channel counts, fft sizes and resampler taps per phase compiled in;
+ * [0] is the generic one */
+static const int deint_channels[] = { 0, 1, 2, 4, 6, 8 };
+static const int fft_points[] = { 0, 64, 128, 256, 512, 1024, 2048, 4096,
+				  8192 };
+static const int resample_taps[] = { 0, 32, 64, 128 };
+static const ne_resample_fn resample_table[] = {
+	resample<0>, resample<32>, resample<64>, resample<128>,
+};
+
+#define NE_DEINT_ROW(bytes, width, be) \
+	{ bytes, width, be, { \
+		deint<bytes, width, be, 0>, deint<bytes, width, be, 1>, \
+		deint<bytes, width, be, 2>, deint<bytes, width, be, 4>, \
+		deint<bytes, width, be, 6>, deint<bytes, width, be, 8> } }
+
+static const struct {
+	int bytes, width, big_endian;
+	ne_deint_fn fn[sizeof(deint_channels) / sizeof(deint_channels[0])];
+} deint_table[] = {
+	NE_DEINT_ROW(2, 16, false),	/* S16_LE */
+	NE_DEINT_ROW(2, 16, true),	/* S16_BE */
+	NE_DEINT_ROW(4, 24, false),	/* S24_LE */
+	NE_DEINT_ROW(4, 24, true),	/* S24_BE */
+	NE_DEINT_ROW(4, 32, false),	/* S32_LE */
+	NE_DEINT_ROW(4, 32, true),	/* S32_BE */
+	NE_DEINT_ROW(3, 24, false),	/* S24_3LE */
+	NE_DEINT_ROW(3, 24, true),	/* S24_3BE */
+};
+
+#define NE_FFT_ROW(n) { window<n>, window2<n>, power<n>, stats<n> }
+
+static const struct {
+	ne_window_fn window;
+	ne_window2_fn window2;
+	ne_power_fn power;
+	ne_stats_fn stats;
+} fft_table[] = {
+	NE_FFT_ROW(0), NE_FFT_ROW(64), NE_FFT_ROW(128), NE_FFT_ROW(256),
+	NE_FFT_ROW(512), NE_FFT_ROW(1024), NE_FFT_ROW(2048), NE_FFT_ROW(4096),
+	NE_FFT_ROW(8192),
+};
+
+#define NE_ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static size_t resample_index(int taps)
+{
+	size_t i;
+
+	for (i = NE_ARRAY_SIZE(resample_taps) - 1; i > 0; i--)
+		if (resample_taps[i] == taps)
+			break;
+	return i;
+}
+
+extern "C" void ne_kernels_select(struct ne_kernels *k, int bytes, int width,
+				  int big_endian, int channels, int n_points,
+				  int taps)
+{
+	size_t i, j;
+
+	k->deint = NULL;
+	k->deint_fixed = 0;
+	for (i = 0; i < NE_ARRAY_SIZE(deint_table); i++) {
+		if (deint_table[i].bytes != bytes
+		    || deint_table[i].width != width
+		    || deint_table[i].big_endian != !!big_endian)
+			continue;
+		k->deint = deint_table[i].fn[0];
+		for (j = 1; j < NE_ARRAY_SIZE(deint_channels); j++)
+			if (deint_channels[j] == channels) {
+				k->deint = deint_table[i].fn[j];
+				k->deint_fixed = channels;
+			}
+		break;
+	}
+
+	for (i = NE_ARRAY_SIZE(fft_points) - 1; i > 0; i--)
+		if (fft_points[i] == n_points)
+			break;
+	k->window = fft_table[i].window;
+	k->window2 = fft_table[i].window2;
+	k->power = fft_table[i].power;
+	k->stats = fft_table[i].stats;
+	k->n_fixed = fft_points[i];
+
+	i = resample_index(taps);
+	k->resample = resample_table[i];
+	k->taps_fixed = resample_taps[i];
+}
+
+extern "C" ne_resample_fn ne_resample_select(int taps)
+{
+	return resample_table[resample_index(taps)];
+}
@@ -0,0 +1,87 @@
+/*
+ * file:  ne_kernels.h
+ * desc:  per-period DSP kernels of `ne_alsa_capture.c` (sample format
+ *        conversion, resampling, fft windowing, fft power, level),
+ *        specialized at compile time in `ne_kernels.cc` and picked once
+ *        per device
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __NE_KERNELS_H__
+#define __NE_KERNELS_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* fftw_real of the fftw build in use */
+#ifdef FFTW3
+typedef float ne_real;
+#else
+typedef double ne_real;
+#endif
+
+/* interleaved pcm period to per-channel float, channel 0 also as int32 to
+ * "raw0" unless NULL */
+typedef void (*ne_deint_fn)(const void *src, float *dst, int frames,
+			    int channels, int32_t *raw0);
+/* out[i] = x[i] * w[i] */
+typedef void (*ne_window_fn)(const float *x, const double *w, ne_real *out,
+			     int n);
+/* z[2i] = a[i] * w[i], z[2i + 1] = b[i] * w[i] */
+typedef void (*ne_window2_fn)(const float *a, const float *b, const double *w,
+			      ne_real *z, int n);
+/* P[k] = |X[k]|^2 of halfcomplex X, for 0 < k < n/2 */
+typedef void (*ne_power_fn)(const ne_real *X, ne_real *P, int n);
+/* largest |x[i]| and the sum of x[i]^2 */
+typedef void (*ne_stats_fn)(const float *x, int n, float *peak, double *sumsq);
+/*
+ * Polyphase resampling by up/down of the "n" new samples at x[taps - 1],
+ * x[0 .. taps - 2] being the previous call's last ones. "coef" holds the
+ * "taps" (a multiple of 8) of each of the "up" phases, reversed. "*pos"
+ * and "*phase" are the next output's newest input and filter phase, kept
+ * across calls. Returns the outputs written to "out".
+ */
+typedef int (*ne_resample_fn)(const float *x, int n, const float *coef,
+			      int taps, int up, int down, int *pos, int *phase,
+			      float *out);
+
+struct ne_kernels {
+	ne_deint_fn deint;	/* NULL: format not handled here */
+	ne_window_fn window;
+	ne_window2_fn window2;
+	ne_power_fn power;
+	ne_stats_fn stats;
+	ne_resample_fn resample;
+	int deint_fixed;	/* channel count compiled in */
+	int n_fixed;		/* fft size compiled in */
+	int taps_fixed;		/* resampler taps per phase compiled in */
+};
+
+/*
+ * Pick the kernels for a stream of signed little/big endian samples of
+ * "width" bits in "bytes" bytes: specialized ones when "channels",
+ * "n_points" and the resampler's "taps" per phase are among the
+ * compiled-in configurations, generic ones otherwise.
+ */
+void ne_kernels_select(struct ne_kernels *k, int bytes, int width,
+		       int big_endian, int channels, int n_points, int taps);
+/* the resampling kernel for "taps" per phase, for any other filter */
+ne_resample_fn ne_resample_select(int taps);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NE_KERNELS_H__ */
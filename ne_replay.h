@@ -0,0 +1,83 @@
+/*
+ * file:  ne_replay.h
+ * desc:  period log written by `ne_alsa_capture --record` and read back
+ *        by `ne_alsa_capture --replay`
+ *
+ * The log is a plain file meant to be mmap(2)ed: a header, then a ring of
+ * "capacity" fixed-size records, one per captured period, each holding
+ * the raw PCM exactly as read from ALSA plus what the capture
+ * side saw around the read (timestamp, frames still buffered, xruns).
+ * Record n lives in slot (n % capacity), so a long recording keeps the
+ * newest "capacity" periods; head counts the records ever written.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __NE_REPLAY_H__
+#define __NE_REPLAY_H__
+
+#include <stdint.h>
+
+#define NE_REPLAY_MAGIC "NEPERLOG"
+#define NE_REPLAY_VERSION 1
+#define NE_REPLAY_ALIGN 64
+
+/* pcm holds one plane of "frames" samples per channel, in turn, as read
+ * with non-interleaved access */
+#define NE_REPLAY_PLANAR 0x1
+
+/* one period */
+struct ne_replay_period{
+	uint64_t period;      /* capture period index */
+	int64_t tstamp_ns;    /* newest frame's capture time, CLOCK_MONOTONIC */
+	uint32_t avail;       /* frames still in the ALSA buffer after the read */
+	uint32_t xruns;       /* xruns recovered from since the previous period */
+	uint32_t frames;
+	uint32_t pad;
+	uint8_t pcm[];        /* frames * frame_bytes, interleaved or planar */
+};
+
+struct ne_replay_log{
+	char magic[8];        /* NE_REPLAY_MAGIC, not NUL terminated */
+	uint32_t version;     /* NE_REPLAY_VERSION */
+	int32_t format;       /* snd_pcm_format_t */
+	uint32_t rate;
+	uint32_t channels;
+	uint32_t period_frames;
+	uint32_t frame_bytes;
+	uint32_t record_size; /* bytes per record, NE_REPLAY_ALIGN multiple */
+	uint32_t flags;       /* NE_REPLAY_PLANAR */
+	uint64_t capacity;    /* records in the ring */
+	uint64_t head;        /* records written */
+	int64_t trigger_ns;   /* capture start, CLOCK_MONOTONIC */
+} __attribute__((aligned(NE_REPLAY_ALIGN)));
+
+#define NE_REPLAY_RECORD_SIZE(frames, frame_bytes) \
+	((sizeof(struct ne_replay_period) + \
+	  (size_t)(frames) * (frame_bytes) + \
+	  NE_REPLAY_ALIGN - 1) & ~(size_t)(NE_REPLAY_ALIGN - 1))
+#define NE_REPLAY_LOG_SIZE(capacity, record_size) \
+	(sizeof(struct ne_replay_log) + (size_t)(capacity) * (record_size))
+
+static inline struct ne_replay_period *
+ne_replay_record(struct ne_replay_log *log, uint64_t n)
+{
+	return (struct ne_replay_period *)((uint8_t *)(log + 1) +
+		(size_t)(n % log->capacity) * log->record_size);
+}
+
+/* first record still in the ring */
+static inline uint64_t ne_replay_oldest(const struct ne_replay_log *log)
+{
+	return log->head > log->capacity ? log->head - log->capacity : 0;
+}
+
+#endif /* __NE_REPLAY_H__ */